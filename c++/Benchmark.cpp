@@ -0,0 +1,447 @@
+//
+//  Benchmark.cpp
+//
+//  This program drives a MessageDispatcher through a scenario modeled on the
+//  update loop of HelloApp: every frame the objects move, the dispatcher is
+//  updated, and a number of objects send a message to the listeners around
+//  them. It reports the throughput of deliveries, the latency of update()
+//  and the peak memory of the process for each scenario.
+//
+//  The dispatcher runs on virtual time, advanced by one frame per update, so
+//  runs are deterministic for a given seed and do not depend on the speed of
+//  the machine. Without arguments a suite of scenarios from 1k to 1M listeners
+//  is run. Run with --help for the parameters of a single scenario.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "MessageDispatcher.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+/** The spatial indices that the dispatcher can perform range queries on. */
+enum class IndexKind {
+    RTREE,
+    GRID,
+    HASH
+};
+
+/** The parameters of a benchmark scenario. */
+struct Scenario {
+    /// the number of listeners
+    int listeners = 1000;
+    /// the number of message codes, each with its own mailbox
+    int codes = 1;
+    /// the number of message codes each listener subscribes to
+    int codesPerListener = 1;
+    /// the number of messages dispatched per frame
+    int rate = 10;
+    /// the number of distinct listener delays, spread evenly up to maxDelay
+    int delays = 1;
+    /// the largest listener delay, in milliseconds
+    int maxDelay = 0;
+    /// the fraction of objects with a send/receive radius
+    double radiusFraction = 1.0;
+    /// the smallest send/receive radius
+    float minRadius = 50;
+    /// the largest send/receive radius
+    float maxRadius = 50;
+    /// the number of objects per unit of area
+    double density = 0.01;
+    /// the distance each object moves per frame
+    float speed = 1;
+    /// the fraction of objects that move fastSpeed per frame instead, like projectiles
+    double fastFraction = 0;
+    /// the distance the fast objects move per frame
+    float fastSpeed = 20;
+    /// whether the R-Tree pads each object by how far it moves per update
+    bool adaptivePadding = false;
+    /// whether objects tell the R-Tree their velocity instead of letting it observe them
+    bool velocityHints = false;
+    /// the fraction of objects that may escape their boxes before the R-Tree is reconstructed
+    float rebuildFraction = 0.01f;
+    /// whether the R-Tree is rebuilt on a background thread
+    bool backgroundRebuild = false;
+    /// the algorithm the R-Tree uses to insert objects and split nodes
+    RTreeSplit split = RTreeSplit::LINEAR;
+    /// the spatial index of the listeners
+    IndexKind index = IndexKind::RTREE;
+    /// the length of the sides of the grid and hash cells, or 0 for the largest radius
+    float cellSize = 0;
+    /// the number of measured frames
+    int frames = 100;
+    /// the length of a frame, in microseconds
+    Uint64 frameMicros = 16667;
+    /// the seed of the random number generator
+    unsigned seed = 1;
+    /// the file to write a Chrome trace of the measured frames to, if any
+    std::string trace;
+};
+
+/** The results of a benchmark scenario. */
+struct Result {
+    /// the time it took to create the dispatcher and add the listeners, in seconds
+    double setupSeconds = 0;
+    /// the time spent in update() and dispatching, in seconds
+    double runSeconds = 0;
+    /// the number of delivered messages
+    Uint64 deliveries = 0;
+    /// the latency of every update() call, in microseconds
+    std::vector<double> updateMicros;
+    /// the peak resident memory during the scenario, in kilobytes
+    long peakKilobytes = 0;
+};
+
+/// the number of messages delivered to any listener
+static Uint64 deliveries = 0;
+
+/** A listener that moves in a straight line and bounces off the walls. */
+class BenchObject : public Telegraph {
+public:
+    float velX;
+    float velY;
+
+    BenchObject(float x, float y, float radius, float velX, float velY)
+    : Telegraph(x, y, 2, 2, radius), velX(velX), velY(velY) {}
+
+    void handleMessage(const TelegramPtr&) override {
+        deliveries++;
+    }
+
+    void update(float mapWidth, float mapHeight) {
+        if (rect.getMaxX() + velX >= mapWidth || rect.getMinX() + velX < 0) {
+            velX = -velX;
+        }
+        if (rect.getMaxY() + velY >= mapHeight || rect.getMinY() + velY < 0) {
+            velY = -velY;
+        }
+        rect.origin.x += velX;
+        rect.origin.y += velY;
+    }
+};
+
+/**
+ * Resets the peak resident memory of the process, so that the next call to
+ * peakMemory() only covers what happens from now on. This is only supported
+ * on Linux; elsewhere the peak covers the whole process.
+ */
+static void resetPeakMemory() {
+#ifdef __linux__
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+#endif
+}
+
+/**
+ * Returns the peak resident memory of the process in kilobytes, or 0 if it
+ * is not known on this platform.
+ */
+static long peakMemory() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Returns the given percentile of a sorted list of samples.
+ *
+ * @param sorted the samples, sorted in ascending order
+ * @param p the percentile, between 0 and 100
+ */
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(i, 1)) - 1];
+}
+
+/**
+ * Creates the spatial index of a scenario.
+ *
+ * @param s the scenario to create the index for
+ * @param side the length of the sides of the area of the scenario
+ */
+static std::shared_ptr<SpatialIndex> makeIndex(const Scenario& s, float side) {
+    float cellSize = s.cellSize > 0 ? s.cellSize : std::max(s.maxRadius, 1.0f);
+    switch (s.index) {
+        case IndexKind::GRID:
+            return std::make_shared<UniformGrid>(0, 0, side, side, cellSize);
+        case IndexKind::HASH:
+            return std::make_shared<SpatialHash>(cellSize);
+        default:
+            return std::make_shared<RTree>(0, 0, side, side, 5, 2, 10, s.split);
+    }
+}
+
+/**
+ * Runs a scenario and returns its results.
+ *
+ * @param s the scenario to run
+ */
+static Result run(const Scenario& s) {
+    typedef std::chrono::steady_clock Clock;
+    Result result;
+    resetPeakMemory();
+
+    std::mt19937 rng(s.seed);
+    std::uniform_real_distribution<float> unit(0, 1);
+    float side = static_cast<float>(std::sqrt(s.listeners / s.density));
+
+    auto setupStart = Clock::now();
+    std::vector<std::shared_ptr<BenchObject>> objects;
+    objects.reserve(s.listeners);
+    {
+        MessageDispatcher dispatcher(makeIndex(s, side));
+        dispatcher.getClock().setVirtual(true);
+        if (RTree* rtree = dispatcher.getRTree()) {
+            rtree->setMaxEscapedFraction(s.rebuildFraction);
+            rtree->setBackgroundRebuild(s.backgroundRebuild);
+            rtree->setAdaptivePadding(s.adaptivePadding);
+        }
+        for (int code = 0; code < s.codes; code++) {
+            dispatcher.addMailbox(code);
+        }
+
+        for (int i = 0; i < s.listeners; i++) {
+            float radius = -1;
+            if (unit(rng) < s.radiusFraction) {
+                radius = s.minRadius + unit(rng) * (s.maxRadius - s.minRadius);
+            }
+            float speed = s.speed;
+            if (s.fastFraction > 0 && unit(rng) < s.fastFraction) {
+                speed = s.fastSpeed;
+            }
+            float angle = unit(rng) * 6.2831853f;
+            auto obj = std::make_shared<BenchObject>(unit(rng) * (side - 2), unit(rng) * (side - 2), radius,
+                                                     speed * std::cos(angle), speed * std::sin(angle));
+            if (s.velocityHints) {
+                obj->setVelocity(obj->velX, obj->velY);
+            }
+            objects.push_back(obj);
+
+            int subscriptions = std::min(s.codesPerListener, s.codes);
+            int first = static_cast<int>(rng() % s.codes);
+            for (int j = 0; j < subscriptions; j++) {
+                int delay = 0;
+                if (s.delays > 1) {
+                    delay = static_cast<int>(rng() % s.delays) * s.maxDelay / (s.delays - 1);
+                } else {
+                    delay = s.maxDelay;
+                }
+                dispatcher.addListener(obj, (first + j) % s.codes, delay);
+            }
+        }
+        result.setupSeconds = std::chrono::duration<double>(Clock::now() - setupStart).count();
+
+        deliveries = 0;
+        Tracer::get().clear();
+        result.updateMicros.reserve(s.frames);
+        Clock::duration running = Clock::duration::zero();
+        for (int frame = 0; frame < s.frames; frame++) {
+            for (auto& obj : objects) {
+                obj->update(side, side);
+            }
+            dispatcher.getClock().advance(s.frameMicros);
+
+            auto updateStart = Clock::now();
+            dispatcher.update();
+            auto updateEnd = Clock::now();
+            for (int i = 0; i < s.rate; i++) {
+                const auto& sender = objects[rng() % objects.size()];
+                dispatcher.dispatchMessage(sender, static_cast<int>(rng() % s.codes));
+            }
+            auto dispatchEnd = Clock::now();
+
+            result.updateMicros.push_back(std::chrono::duration<double, std::micro>(updateEnd - updateStart).count());
+            running += dispatchEnd - updateStart;
+        }
+        result.runSeconds = std::chrono::duration<double>(running).count();
+        result.deliveries = deliveries;
+        result.peakKilobytes = peakMemory();
+    }
+
+    if (!s.trace.empty() && !Tracer::get().writeChromeTrace(s.trace)) {
+        std::fprintf(stderr, "could not write %s\n", s.trace.c_str());
+    }
+
+    std::sort(result.updateMicros.begin(), result.updateMicros.end());
+    return result;
+}
+
+/** Prints the header of the result table. */
+static void printHeader() {
+    std::printf("%9s %5s %5s %6s %7s %8s %12s %13s %9s %9s %9s %9s %9s\n",
+                "listeners", "codes", "rate", "delays", "frames", "setup s",
+                "deliveries", "deliveries/s", "p50 us", "p90 us", "p99 us", "max us", "peak MB");
+}
+
+/**
+ * Prints the results of a scenario as a row of the result table.
+ *
+ * @param s the scenario that was run
+ * @param r the results of the scenario
+ */
+static void printResult(const Scenario& s, const Result& r) {
+    double throughput = r.runSeconds > 0 ? r.deliveries / r.runSeconds : 0;
+    std::printf("%9d %5d %5d %6d %7d %8.2f %12llu %13.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                s.listeners, s.codes, s.rate, s.delays, s.frames, r.setupSeconds,
+                static_cast<unsigned long long>(r.deliveries), throughput,
+                percentile(r.updateMicros, 50), percentile(r.updateMicros, 90),
+                percentile(r.updateMicros, 99), percentile(r.updateMicros, 100),
+                r.peakKilobytes / 1024.0);
+    std::fflush(stdout);
+}
+
+/** Prints the command line options. */
+static void printUsage(const char* program) {
+    Scenario d;
+    std::printf("usage: %s [options]\n"
+                "Runs a suite of scenarios from 1k to 1M listeners when no options are given.\n\n"
+                "  --listeners N           number of listeners (%d)\n"
+                "  --codes N               number of message codes (%d)\n"
+                "  --codes-per-listener N  codes each listener subscribes to (%d)\n"
+                "  --rate N                messages dispatched per frame (%d)\n"
+                "  --delays N              distinct listener delays (%d)\n"
+                "  --max-delay MS          largest listener delay (%d)\n"
+                "  --radius-fraction F     fraction of objects with a radius (%g)\n"
+                "  --min-radius R          smallest radius (%g)\n"
+                "  --max-radius R          largest radius (%g)\n"
+                "  --density D             objects per unit of area (%g)\n"
+                "  --speed S               distance moved per frame (%g)\n"
+                "  --fast-fraction F       fraction of objects moving at the fast speed (%g)\n"
+                "  --fast-speed S          distance the fast objects move per frame (%g)\n"
+                "  --adaptive-padding B    pad R-Tree boxes by how far objects move (%d)\n"
+                "  --velocity-hints B      give the R-Tree the velocities of the objects (%d)\n"
+                "  --rebuild-fraction F    escaped fraction that rebuilds the R-Tree (%g)\n"
+                "  --background-rebuild B  rebuild the R-Tree on a background thread (%d)\n"
+                "  --split NAME            R-Tree split: linear, quadratic or rstar (linear)\n"
+                "  --index NAME            spatial index: rtree, grid or hash (rtree)\n"
+                "  --cell-size S           side of the grid and hash cells (largest radius)\n"
+                "  --frames N              measured frames (%d)\n"
+                "  --seed N                random seed (%u)\n"
+                "  --trace FILE            write a Chrome trace (needs MSG_TRACE)\n",
+                program, d.listeners, d.codes, d.codesPerListener, d.rate, d.delays, d.maxDelay,
+                d.radiusFraction, d.minRadius, d.maxRadius, d.density, d.speed, d.fastFraction, d.fastSpeed, d.adaptivePadding, d.velocityHints, d.rebuildFraction, d.backgroundRebuild, d.frames, d.seed);
+}
+
+int main(int argc, char** argv) {
+    Scenario scenario;
+    bool custom = false;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "missing value for %s\n", arg);
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (std::strcmp(arg, "--listeners") == 0) scenario.listeners = std::atoi(value);
+        else if (std::strcmp(arg, "--codes") == 0) scenario.codes = std::atoi(value);
+        else if (std::strcmp(arg, "--codes-per-listener") == 0) scenario.codesPerListener = std::atoi(value);
+        else if (std::strcmp(arg, "--rate") == 0) scenario.rate = std::atoi(value);
+        else if (std::strcmp(arg, "--delays") == 0) scenario.delays = std::atoi(value);
+        else if (std::strcmp(arg, "--max-delay") == 0) scenario.maxDelay = std::atoi(value);
+        else if (std::strcmp(arg, "--radius-fraction") == 0) scenario.radiusFraction = std::atof(value);
+        else if (std::strcmp(arg, "--min-radius") == 0) scenario.minRadius = static_cast<float>(std::atof(value));
+        else if (std::strcmp(arg, "--max-radius") == 0) scenario.maxRadius = static_cast<float>(std::atof(value));
+        else if (std::strcmp(arg, "--density") == 0) scenario.density = std::atof(value);
+        else if (std::strcmp(arg, "--speed") == 0) scenario.speed = static_cast<float>(std::atof(value));
+        else if (std::strcmp(arg, "--fast-fraction") == 0) scenario.fastFraction = std::atof(value);
+        else if (std::strcmp(arg, "--fast-speed") == 0) scenario.fastSpeed = static_cast<float>(std::atof(value));
+        else if (std::strcmp(arg, "--adaptive-padding") == 0) scenario.adaptivePadding = std::atoi(value) != 0;
+        else if (std::strcmp(arg, "--velocity-hints") == 0) scenario.velocityHints = std::atoi(value) != 0;
+        else if (std::strcmp(arg, "--rebuild-fraction") == 0) scenario.rebuildFraction = static_cast<float>(std::atof(value));
+        else if (std::strcmp(arg, "--background-rebuild") == 0) scenario.backgroundRebuild = std::atoi(value) != 0;
+        else if (std::strcmp(arg, "--split") == 0 && std::strcmp(value, "linear") == 0) scenario.split = RTreeSplit::LINEAR;
+        else if (std::strcmp(arg, "--split") == 0 && std::strcmp(value, "quadratic") == 0) scenario.split = RTreeSplit::QUADRATIC;
+        else if (std::strcmp(arg, "--split") == 0 && std::strcmp(value, "rstar") == 0) scenario.split = RTreeSplit::RSTAR;
+        else if (std::strcmp(arg, "--index") == 0 && std::strcmp(value, "rtree") == 0) scenario.index = IndexKind::RTREE;
+        else if (std::strcmp(arg, "--index") == 0 && std::strcmp(value, "grid") == 0) scenario.index = IndexKind::GRID;
+        else if (std::strcmp(arg, "--index") == 0 && std::strcmp(value, "hash") == 0) scenario.index = IndexKind::HASH;
+        else if (std::strcmp(arg, "--cell-size") == 0) scenario.cellSize = static_cast<float>(std::atof(value));
+        else if (std::strcmp(arg, "--frames") == 0) scenario.frames = std::atoi(value);
+        else if (std::strcmp(arg, "--seed") == 0) scenario.seed = static_cast<unsigned>(std::atoi(value));
+        else if (std::strcmp(arg, "--trace") == 0) scenario.trace = value;
+        else {
+            std::fprintf(stderr, "unknown option %s\n", arg);
+            printUsage(argv[0]);
+            return 1;
+        }
+        custom = true;
+    }
+
+    if (scenario.listeners <= 0 || scenario.codes <= 0 || scenario.frames <= 0 || scenario.density <= 0) {
+        std::fprintf(stderr, "listeners, codes, frames and density must be positive\n");
+        return 1;
+    }
+
+    printHeader();
+    if (custom) {
+        printResult(scenario, run(scenario));
+        return 0;
+    }
+
+    // the suite: immediate and delayed messages at every size, with fewer
+    // frames for the largest sizes so that the suite finishes in minutes
+    for (int listeners : {1000, 10000, 100000, 1000000}) {
+        Scenario s;
+        s.listeners = listeners;
+        s.codes = 4;
+        s.codesPerListener = 2;
+        s.rate = 20;
+        s.frames = listeners >= 1000000 ? 10 : (listeners >= 100000 ? 30 : 100);
+        printResult(s, run(s));
+
+        s.delays = 4;
+        s.maxDelay = 100;
+        printResult(s, run(s));
+    }
+    return 0;
+}
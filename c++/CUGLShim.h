@@ -0,0 +1,208 @@
+//
+//  CUGLShim.h
+//
+//  This header provides the CUGL types used by the messaging core. In a game
+//  it simply includes CUGL. When MSG_HEADLESS is defined, it instead defines
+//  minimal versions of Vec2, Size, Rect and Timestamp with the same interface,
+//  so that the Mailbox, MessageDispatcher, RTree and Telegraph classes can be
+//  built and benchmarked without the game framework. The debug draw methods
+//  are not available in a headless build.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_SHIM_H
+#define CUGL_SHIM_H
+
+#ifndef MSG_HEADLESS
+
+#include <cugl/cugl.h>
+
+#else
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+/// the SDL integer type that CUGL uses for times
+typedef uint64_t Uint64;
+
+namespace cugl {
+
+/** A two dimensional vector. */
+class Vec2 {
+public:
+    /** The x coordinate. */
+    float x;
+    /** The y coordinate. */
+    float y;
+
+    /** Creates the zero vector. */
+    Vec2() : x(0), y(0) {}
+
+    /** Creates a vector with the given coordinates. */
+    Vec2(float x, float y) : x(x), y(y) {}
+};
+
+/** A two dimensional size. */
+class Size {
+public:
+    /** The width. */
+    float width;
+    /** The height. */
+    float height;
+
+    /** Creates the zero size. */
+    Size() : width(0), height(0) {}
+
+    /** Creates a size with the given dimensions. */
+    Size(float width, float height) : width(width), height(height) {}
+};
+
+/** An axis-aligned rectangle, given by its bottom left corner and its size. */
+class Rect {
+public:
+    /** The bottom left corner. */
+    Vec2 origin;
+    /** The size. */
+    Size size;
+
+    /** Creates the empty rectangle at the origin. */
+    Rect() {}
+
+    /** Creates a rectangle with the given corner and dimensions. */
+    Rect(float x, float y, float width, float height) : origin(x, y), size(width, height) {}
+
+    /** Returns the smallest x coordinate of this rectangle. */
+    float getMinX() const { return origin.x; }
+    /** Returns the center x coordinate of this rectangle. */
+    float getMidX() const { return origin.x + size.width / 2.0f; }
+    /** Returns the largest x coordinate of this rectangle. */
+    float getMaxX() const { return origin.x + size.width; }
+    /** Returns the smallest y coordinate of this rectangle. */
+    float getMinY() const { return origin.y; }
+    /** Returns the center y coordinate of this rectangle. */
+    float getMidY() const { return origin.y + size.height / 2.0f; }
+    /** Returns the largest y coordinate of this rectangle. */
+    float getMaxY() const { return origin.y + size.height; }
+
+    /**
+     * Returns true if this rectangle contains the given rectangle.
+     *
+     * @param rect the rectangle to test
+     */
+    bool contains(const Rect& rect) const {
+        return getMinX() <= rect.getMinX() && rect.getMaxX() <= getMaxX() &&
+               getMinY() <= rect.getMinY() && rect.getMaxY() <= getMaxY();
+    }
+
+    /**
+     * Returns true if this rectangle fits inside the given rectangle.
+     *
+     * @param rect the rectangle to test
+     */
+    bool inside(const Rect& rect) const {
+        return rect.contains(*this);
+    }
+
+    /**
+     * Returns true if this rectangle intersects the given rectangle.
+     *
+     * @param rect the rectangle to test
+     */
+    bool doesIntersect(const Rect& rect) const {
+        return !(getMaxX() < rect.getMinX() || rect.getMaxX() < getMinX() ||
+                 getMaxY() < rect.getMinY() || rect.getMaxY() < getMinY());
+    }
+
+    /**
+     * Returns true if this rectangle intersects the given circle.
+     *
+     * @param center the center of the circle
+     * @param radius the radius of the circle
+     */
+    bool doesIntersect(const Vec2 center, float radius) const {
+        float dx = center.x - std::max(getMinX(), std::min(center.x, getMaxX()));
+        float dy = center.y - std::max(getMinY(), std::min(center.y, getMaxY()));
+        return dx * dx + dy * dy <= radius * radius;
+    }
+
+    /**
+     * Returns the smallest rectangle containing this one and the given one.
+     *
+     * @param rect the rectangle to merge with
+     */
+    Rect getMerge(const Rect& rect) const {
+        float minX = std::min(getMinX(), rect.getMinX());
+        float minY = std::min(getMinY(), rect.getMinY());
+        float maxX = std::max(getMaxX(), rect.getMaxX());
+        float maxY = std::max(getMaxY(), rect.getMaxY());
+        return Rect(minX, minY, maxX - minX, maxY - minY);
+    }
+
+    /**
+     * Merges the given rectangle into this one.
+     *
+     * @param rect the rectangle to merge with
+     */
+    Rect& operator+=(const Rect& rect) {
+        return *this = getMerge(rect);
+    }
+};
+
+/** A moment in time, read from a monotonic clock. */
+class Timestamp {
+public:
+    /** Creates a timestamp for the current time. */
+    Timestamp() : time(std::chrono::steady_clock::now()) {}
+
+    /** Sets this timestamp to the current time. */
+    void mark() {
+        time = std::chrono::steady_clock::now();
+    }
+
+    /** Returns the milliseconds that ellapsed from start to end. */
+    static Uint64 ellapsedMillis(const Timestamp& start, const Timestamp& end) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(end.time - start.time).count();
+    }
+
+    /** Returns the microseconds that ellapsed from start to end. */
+    static Uint64 ellapsedMicros(const Timestamp& start, const Timestamp& end) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(end.time - start.time).count();
+    }
+
+    /** Returns the nanoseconds that ellapsed from start to end. */
+    static Uint64 ellapsedNanos(const Timestamp& start, const Timestamp& end) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end.time - start.time).count();
+    }
+
+private:
+    /// the moment of this timestamp
+    std::chrono::steady_clock::time_point time;
+};
+
+}
+
+#endif
+
+#endif //CUGL_SHIM_H
@@ -0,0 +1,75 @@
+//
+//  FrameClock.cpp
+//
+//  This class implements a FrameClock object. The MessageDispatcher samples
+//  the clock once per update, and every message dispatched or delivered in
+//  that frame is stamped with the sampled time, so no message reads the OS
+//  clock. The clock can also run on virtual time, which only moves when it
+//  is advanced explicitly.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "FrameClock.h"
+
+/**
+ * Creates a clock that follows real time, starting at zero.
+ */
+FrameClock::FrameClock() : now(0), virtualTime(false), offset(0) {}
+
+/**
+ * Samples the clock. On real time this reads the OS clock; on virtual
+ * time this does nothing, since the time only moves with advance().
+ */
+void FrameClock::tick() {
+    if (!virtualTime) {
+        now = offset + Timestamp::ellapsedMicros(start, Timestamp());
+    }
+}
+
+/**
+ * Switches between real and virtual time. The time continues from its
+ * current value in either direction, so it never jumps backwards.
+ *
+ * @param value whether the clock should run on virtual time
+ */
+void FrameClock::setVirtual(bool value) {
+    if (value == virtualTime) return;
+    tick();
+    virtualTime = value;
+    if (!virtualTime) {
+        start = Timestamp();
+        offset = now;
+    }
+}
+
+/**
+ * Moves virtual time forward. This is a no-op on real time.
+ *
+ * @param micros the number of microseconds to move forward
+ */
+void FrameClock::advance(Uint64 micros) {
+    if (virtualTime) {
+        now += micros;
+    }
+}
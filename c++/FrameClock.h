@@ -0,0 +1,104 @@
+//
+//  FrameClock.h
+//
+//  This class implements a FrameClock object. The MessageDispatcher samples
+//  the clock once per update, and every message dispatched or delivered in
+//  that frame is stamped with the sampled time, so no message reads the OS
+//  clock. The clock can also run on virtual time, which only moves when it
+//  is advanced explicitly. This allows headless simulations and benchmarks to
+//  run much faster than real time with a deterministic delivery order.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_FRAMECLOCK_H
+#define CUGL_FRAMECLOCK_H
+
+#include "CUGLShim.h"
+
+using namespace cugl;
+
+class FrameClock {
+public:
+    /**
+     * Creates a clock that follows real time, starting at zero.
+     */
+    FrameClock();
+
+    /**
+     * Samples the clock. On real time this reads the OS clock; on virtual
+     * time this does nothing, since the time only moves with advance().
+     */
+    void tick();
+
+    /**
+     * Returns the time of the last sample, in milliseconds since the clock
+     * was created.
+     */
+    Uint64 getTime() const {
+        return now / 1000;
+    }
+
+    /**
+     * Returns the time of the last sample, in microseconds since the clock
+     * was created.
+     */
+    Uint64 getTimeMicros() const {
+        return now;
+    }
+
+    /**
+     * Switches between real and virtual time. The time continues from its
+     * current value in either direction, so it never jumps backwards.
+     *
+     * @param value whether the clock should run on virtual time
+     */
+    void setVirtual(bool value);
+
+    /** Returns whether the clock runs on virtual time. */
+    bool isVirtual() const {
+        return virtualTime;
+    }
+
+    /**
+     * Moves virtual time forward. This is a no-op on real time.
+     *
+     * @param micros the number of microseconds to move forward
+     */
+    void advance(Uint64 micros);
+
+private:
+    /// the time of the last sample, in microseconds
+    Uint64 now;
+
+    /// whether the clock runs on virtual time
+    bool virtualTime;
+
+    /// the moment at which the clock last started following real time
+    Timestamp start;
+
+    /// the time of the clock (in microseconds) at start
+    Uint64 offset;
+};
+
+#endif //CUGL_FRAMECLOCK_H
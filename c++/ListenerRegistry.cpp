@@ -0,0 +1,157 @@
+//
+//  ListenerRegistry.cpp
+//
+//  This class implements a ListenerRegistry object, which holds the listeners
+//  of a Mailbox grouped by their delay. Every delay has a bucket with a
+//  contiguous array of listeners, and the buckets are sorted by delay, so a
+//  broadcast streams through memory linearly. Listeners are removed with a
+//  swap-remove through an index, without scanning. While a broadcast loops over
+//  a bucket, removals are deferred so that the handlers can change the listeners.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "ListenerRegistry.h"
+#include <algorithm>
+
+/**
+ * Returns the position of the first bucket with a delay that is not less
+ * than the given one.
+ */
+std::vector<ListenerRegistry::Bucket>::iterator ListenerRegistry::lowerBound(Uint64 delay) {
+    return std::lower_bound(buckets.begin(), buckets.end(), delay,
+                            [](const Bucket& b, Uint64 d) { return b.delay < d; });
+}
+
+/**
+ * Registers a listener with the given delay. If the listener is already
+ * registered, the new delay will replace the old one.
+ *
+ * @param listener the listener to register
+ * @param delay the delay (in milliseconds) of the listener
+ */
+void ListenerRegistry::add(const std::shared_ptr<Telegraph>& listener, Uint64 delay) {
+    Uint64 current;
+    if (getDelay(listener.get(), current)) {
+        if (current == delay) return;
+        remove(listener.get());
+    }
+
+    auto it = lowerBound(delay);
+    if (it == buckets.end() || it->delay != delay) {
+        it = buckets.insert(it, Bucket{delay, {}});
+        generation++;
+    }
+    index[listener.get()] = Slot{delay, it->listeners.size()};
+    it->listeners.push_back(listener);
+}
+
+/**
+ * Looks up the shared pointer and delay of a listener.
+ *
+ * @param listener the listener to look up
+ * @param delay set to the delay of the listener if it is registered
+ * @return the registered pointer to the listener, or nullptr if it is not registered
+ */
+const std::shared_ptr<Telegraph>* ListenerRegistry::find(const Telegraph* listener, Uint64& delay) const {
+    auto it = index.find(listener);
+    if (it == index.end()) return nullptr;
+    delay = it->second.delay;
+    const Bucket* bucket = getBucket(delay);
+    return &bucket->listeners[it->second.position];
+}
+
+/**
+ * Unregisters a listener. This operation is a no-op if the listener is
+ * not registered.
+ *
+ * @param listener the listener to remove
+ * @return whether the listener was registered
+ */
+bool ListenerRegistry::remove(const Telegraph* listener) {
+    auto found = index.find(listener);
+    if (found == index.end()) return false;
+    Slot slot = found->second;
+    index.erase(found);
+
+    auto it = lowerBound(slot.delay);
+    std::vector<std::shared_ptr<Telegraph>>& bucket = it->listeners;
+
+    // a loop over the bucket would skip the listener moved into the hole
+    if (iterating > 0) {
+        removed.push_back(std::move(bucket[slot.position]));
+        holes.push_back(slot);
+        return true;
+    }
+
+    // move the last listener of the bucket into the hole
+    if (slot.position != bucket.size() - 1) {
+        bucket[slot.position] = std::move(bucket.back());
+        index[bucket[slot.position].get()].position = slot.position;
+    }
+    bucket.pop_back();
+
+    if (bucket.empty()) {
+        buckets.erase(it);
+    }
+    return true;
+}
+
+/**
+ * Ends a loop over the listeners of a bucket. When the outermost loop
+ * ends, the empty slots are removed and the removed listeners released.
+ */
+void ListenerRegistry::endIteration() {
+    if (--iterating > 0 || holes.empty()) return;
+
+    // the last holes of a bucket go first, so that no hole is moved into another
+    std::sort(holes.begin(), holes.end(), [](const Slot& a, const Slot& b) {
+        return a.delay != b.delay ? a.delay < b.delay : a.position > b.position;
+    });
+    for (const Slot& hole : holes) {
+        std::vector<std::shared_ptr<Telegraph>>& bucket = lowerBound(hole.delay)->listeners;
+        if (hole.position != bucket.size() - 1) {
+            bucket[hole.position] = std::move(bucket.back());
+            index[bucket[hole.position].get()].position = hole.position;
+        }
+        bucket.pop_back();
+    }
+    holes.clear();
+    buckets.erase(std::remove_if(buckets.begin(), buckets.end(),
+                                 [](const Bucket& b) { return b.listeners.empty(); }),
+                  buckets.end());
+    removed.clear();
+}
+
+/**
+ * Returns the bucket of listeners with the given delay, or nullptr if no
+ * listener has that delay.
+ *
+ * @param delay the delay (in milliseconds) to look up
+ */
+const ListenerRegistry::Bucket* ListenerRegistry::getBucket(Uint64 delay) const {
+    auto it = std::lower_bound(buckets.begin(), buckets.end(), delay,
+                               [](const Bucket& b, Uint64 d) { return b.delay < d; });
+    if (it == buckets.end() || it->delay != delay) return nullptr;
+    return &*it;
+}
@@ -0,0 +1,179 @@
+//
+//  ListenerRegistry.h
+//
+//  This class implements a ListenerRegistry object, which holds the listeners
+//  of a Mailbox grouped by their delay. Every delay has a bucket with a
+//  contiguous array of listeners, and the buckets are sorted by delay, so a
+//  broadcast streams through memory linearly. Listeners are removed with a
+//  swap-remove through an index, without scanning. While a broadcast loops over
+//  a bucket, removals are deferred so that the handlers can change the listeners.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_LISTENERREGISTRY_H
+#define CUGL_LISTENERREGISTRY_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Telegraph.h"
+
+class ListenerRegistry {
+public:
+    /** The listeners that share a delay. */
+    struct Bucket {
+        /** The delay (in milliseconds) of the listeners in this bucket. */
+        Uint64 delay;
+        /** The listeners in this bucket, in no particular order. */
+        std::vector<std::shared_ptr<Telegraph>> listeners;
+    };
+
+    /**
+     * Registers a listener with the given delay. If the listener is already
+     * registered, the new delay will replace the old one.
+     *
+     * @param listener the listener to register
+     * @param delay the delay (in milliseconds) of the listener
+     */
+    void add(const std::shared_ptr<Telegraph>& listener, Uint64 delay);
+
+    /**
+     * Unregisters a listener. This operation is a no-op if the listener is
+     * not registered.
+     *
+     * @param listener the listener to remove
+     * @return whether the listener was registered
+     */
+    bool remove(const Telegraph* listener);
+
+    /**
+     * Looks up the delay of a listener.
+     *
+     * @param listener the listener to look up
+     * @param delay set to the delay of the listener if it is registered
+     * @return whether the listener is registered
+     */
+    bool getDelay(const Telegraph* listener, Uint64& delay) const {
+        auto it = index.find(listener);
+        if (it == index.end()) return false;
+        delay = it->second.delay;
+        return true;
+    }
+
+    /**
+     * Looks up the shared pointer and delay of a listener.
+     *
+     * @param listener the listener to look up
+     * @param delay set to the delay of the listener if it is registered
+     * @return the registered pointer to the listener, or nullptr if it is not registered
+     */
+    const std::shared_ptr<Telegraph>* find(const Telegraph* listener, Uint64& delay) const;
+
+    /**
+     * Returns the bucket of listeners with the given delay, or nullptr if no
+     * listener has that delay.
+     *
+     * @param delay the delay (in milliseconds) to look up
+     */
+    const Bucket* getBucket(Uint64 delay) const;
+
+    /**
+     * Returns the buckets, sorted by increasing delay. While an iteration is
+     * running, buckets may be empty or have empty slots.
+     */
+    const std::vector<Bucket>& getBuckets() const {
+        return buckets;
+    }
+
+    /**
+     * Starts a loop over the listeners of a bucket. Until the matching call to
+     * endIteration, a removed listener leaves an empty slot (nullptr) instead
+     * of being swap-removed, and is kept alive. Added listeners are appended,
+     * so a loop that stops at the size the bucket had when it started does not
+     * visit them. Iterations may be nested.
+     */
+    void beginIteration() {
+        iterating++;
+    }
+
+    /**
+     * Ends a loop over the listeners of a bucket. When the outermost loop
+     * ends, the empty slots are removed and the removed listeners released.
+     */
+    void endIteration();
+
+    /**
+     * Returns a number that changes whenever a bucket is created, which moves
+     * the other buckets. A bucket from getBucket must be looked up again when
+     * it changes.
+     */
+    Uint64 getBucketGeneration() const {
+        return generation;
+    }
+
+    /** Returns the number of registered listeners. */
+    size_t size() const {
+        return index.size();
+    }
+
+    /** Returns whether no listeners are registered. */
+    bool empty() const {
+        return index.empty();
+    }
+
+private:
+    /** Where a listener is stored. */
+    struct Slot {
+        /** The delay of the bucket that holds the listener. */
+        Uint64 delay;
+        /** The position of the listener in its bucket. */
+        size_t position;
+    };
+
+    /** The non-empty buckets, sorted by increasing delay. */
+    std::vector<Bucket> buckets;
+
+    /** Maps every registered listener to its slot. */
+    std::unordered_map<const Telegraph*, Slot> index;
+
+    /** The number of iterations that are running. */
+    unsigned int iterating = 0;
+
+    /** The number of times a bucket was created. */
+    Uint64 generation = 0;
+
+    /** The slots emptied while an iteration was running. */
+    std::vector<Slot> holes;
+
+    /** The listeners removed while an iteration was running, kept alive until it ends. */
+    std::vector<std::shared_ptr<Telegraph>> removed;
+
+    /**
+     * Returns the position of the first bucket with a delay that is not less
+     * than the given one.
+     */
+    std::vector<Bucket>::iterator lowerBound(Uint64 delay);
+};
+
+#endif //CUGL_LISTENERREGISTRY_H
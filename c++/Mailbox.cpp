@@ -31,10 +31,13 @@
 
 
 #include "Mailbox.h"
+#include "Trace.h"
+#include <algorithm>
 #include <vector>
 using namespace cugl;
 
-Mailbox::Mailbox(int tag){
+Mailbox::Mailbox(int tag, const std::shared_ptr<TelegramPool>& pool,
+                 const MailboxOptions& options) : options(options), pool(pool) {
     mailboxTag = tag;
 }
 
@@ -42,93 +45,176 @@ Mailbox::Mailbox(int tag){
  * Updates the mailbox and sends delayed telegrams with an expired timestamp
  * to listeners.
  *
- * @param rtree The R-Tree on which to perform range queries.
+ * @param now The current time, in milliseconds on the dispatcher's clock.
+ * @param index The spatial index on which to perform range queries.
  */
-void Mailbox::update(std::shared_ptr<RTree> rtree) {
-    Timestamp now;
-    
-    // we pop messages from the queue after the iteration to prevent concurrent modification
-    int messagesToBePopped = 0;
-    
-    for (const std::shared_ptr<Telegram>& msg: messages) {
-        Uint64 elapsedMicrosSinceLastUpdate = cugl::Timestamp::ellapsedMicros(msg->lastUpdate, now);
-        
-        // small optimzation: if we processed this telegram within the last 250 microseconds, return
-        // because it is unlikely that we already have expired timestamps. Can be uncommented.
-        if (elapsedMicrosSinceLastUpdate < 250) return;
-
-        Uint64 elapsedMillisSinceSent = Timestamp::ellapsedMillis(msg->timeSent, now);
-        
-        // What was the delay we processed up to when this message was last updated?
-        Uint64 lastDelay = Timestamp::ellapsedMillis(msg->timeSent, msg->lastUpdate);
-
-        std::shared_ptr<Telegraph> sender = msg->sender;
-
-        bool allListenersReceived = true;
-        // if the sender specified a radius
-        if (sender != nullptr && sender->specifiesRadius()) {
-            // get all listeners in range of sender's AOI
-            std::vector<std::shared_ptr<RTreeObject>> listenersInRange = rtree->search(sender->getCenter(), sender->getRadius(), mailboxTag);
-            
-            for (auto it = listenersInRange.begin(); it != listenersInRange.end(); it++) {
-                // we know only insert Telegraphs into the rtree so this should be a safe cast
-                std::shared_ptr<Telegraph> t = std::dynamic_pointer_cast<Telegraph>(*it);
-                
-                // check if the receiver has a specified radius and if the sender is in the receiver's range
-                if (t->specifiesRadius()
-                        && !sender->rect.doesIntersect(t->getCenter(), t->getRadius())){
-                    continue;
-                }
-
-                long delay = delays.at(t);
-                
-                // check if receiver has received the message
-                if (lastDelay > delay && elapsedMillisSinceSent > delay){
-                    continue;
-                }
-                
-                // check if receiver hasn't received the message yet
-                if(elapsedMillisSinceSent < delay){
-                    allListenersReceived = false;
-                    continue;
-                }
-                
-                t->handleMessage(msg);
+void Mailbox::update(Uint64 now, std::shared_ptr<SpatialIndex> index) {
+    MSG_TRACE_SCOPE_ARG("Mailbox::update", mailboxTag);
+
+    // only the deliveries that expired since the last update are touched
+    wheel.advance(now, expired);
+
+    for (const TimingWheel::Entry& entry : expired) {
+        stats.lateness.record(now - entry.due);
+        deliver(entry.telegram, entry.delay, index);
+    }
+    expired.clear();
+}
+
+/**
+ * Delivers a telegram to the listeners with the given delay. If the sender
+ * specified a radius, only the listeners in range receive the telegram.
+ *
+ * @param telegram the telegram to deliver
+ * @param delay the delay (in milliseconds) of the listeners to deliver to
+ * @param index The spatial index on which to perform range queries.
+ */
+void Mailbox::deliver(const TelegramPtr& telegram, Uint64 delay,
+                      const std::shared_ptr<SpatialIndex>& index) {
+    const std::shared_ptr<Telegraph>& sender = telegram->sender;
+
+    if (telegram->hasRecipients) {
+        deliverSnapshot(telegram, delay);
+    } else if (sender != nullptr && sender->specifiesRadius()) {
+        // the sender specified a radius
+        // get all listeners in range of sender's AOI
+        // the handlers may dispatch through this mailbox again, so the buffer
+        // is taken for the duration of the loop and given back afterwards
+        std::vector<RTreeObject*> listenersInRange;
+        listenersInRange.swap(inRange);
+        index->search(sender->getCenter(), sender->getRadius(), mailboxTag, listenersInRange);
+
+        // listeners removed by the handlers are kept alive until the loop ends
+        listeners.beginIteration();
+
+        for (RTreeObject* obj : listenersInRange) {
+            // we know only insert Telegraphs into the index so this should be a safe cast.
+            // A listener removed by an earlier handler is no longer registered, so
+            // it is skipped before it is dereferenced
+            Telegraph* t = static_cast<Telegraph*>(obj);
+
+            // only the listeners with this delay are due
+            Uint64 listenerDelay;
+            if (!listeners.getDelay(t, listenerDelay) || listenerDelay != delay) {
+                continue;
             }
-        } else {
-            auto it = listeners.upper_bound(lastDelay);
-            if(lastDelay == 0){
-                it = listeners.begin();
+
+            // check if the receiver has a specified radius and if the sender is in the receiver's range
+            if (t->specifiesRadius()
+                    && !sender->rect.doesIntersect(t->getCenter(), t->getRadius())){
+                continue;
             }
-            // otherwise just send to all subscribers
-            for (; it != listeners.end() && it->first <= elapsedMillisSinceSent; it++) {
-                if (it->second->specifiesRadius() &&
-                    !sender->rect.doesIntersect(it->second->getCenter(), it->second->getRadius()))
-                    continue;
-                
-                it->second->handleMessage(msg);
-
-//            Uncomment the lines below for benchmarking
-//            auto measuredDelayMicros = cugl::Timestamp::ellapsedMicros(msg->timeSent, cugl::Timestamp());
-//            measuredDelays.emplace_back(measuredDelayMicros - it->first * 1000, it->first);
+
+            stats.delivered++;
+            MSG_TRACE_SCOPE_ARG("Telegraph::handleMessage", mailboxTag);
+            t->handleMessage(telegram);
+        }
+        listeners.endIteration();
+        listenersInRange.clear();
+        inRange.swap(listenersInRange);
+    } else {
+        const ListenerRegistry::Bucket* bucket = listeners.getBucket(delay);
+        if (bucket == nullptr) {
+            // every listener with this delay was removed after the dispatch
+            stats.dropped++;
+            return;
+        }
+
+        // otherwise just send to all subscribers with this delay. While the loop
+        // runs, listeners that the handlers remove leave empty slots and the ones
+        // they add are appended past count, so they do not receive this telegram
+        listeners.beginIteration();
+        Uint64 generation = listeners.getBucketGeneration();
+        size_t count = bucket->listeners.size();
+        for (size_t i = 0; i < count; i++) {
+            // a handler created a bucket, which moved this one
+            if (listeners.getBucketGeneration() != generation) {
+                generation = listeners.getBucketGeneration();
+                bucket = listeners.getBucket(delay);
             }
-            if (it != listeners.end()) {
-                allListenersReceived = false;
+            Telegraph* listener = bucket->listeners[i].get();
+            if (listener == nullptr) {
+                continue;
             }
+
+            if (sender != nullptr && listener->specifiesRadius() &&
+                !sender->rect.doesIntersect(listener->getCenter(), listener->getRadius()))
+                continue;
+
+            stats.delivered++;
+            MSG_TRACE_SCOPE_ARG("Telegraph::handleMessage", mailboxTag);
+            listener->handleMessage(telegram);
         }
+        listeners.endIteration();
+    }
+}
 
-        // if we have sent to all subscribers, pop the message from the queue
-        if (allListenersReceived) {
-            messagesToBePopped++;
-        } else {
-            msg->lastUpdate = now;
+/**
+ * Resolves the listeners in range of the sender of a telegram and stores
+ * them in the telegram, sorted by delay.
+ *
+ * @param telegram the telegram to resolve the recipients of
+ * @param index The spatial index on which to perform range queries.
+ */
+void Mailbox::snapshotRecipients(Telegram& telegram, const std::shared_ptr<SpatialIndex>& index) {
+    const std::shared_ptr<Telegraph>& sender = telegram.sender;
+    index->search(sender->getCenter(), sender->getRadius(), mailboxTag, inRange);
+    for (RTreeObject* obj : inRange) {
+        // we know only insert Telegraphs into the index so this should be a safe cast
+        Telegraph* t = static_cast<Telegraph*>(obj);
+
+        Uint64 delay;
+        const std::shared_ptr<Telegraph>* listener = listeners.find(t, delay);
+        if (listener == nullptr) {
+            continue;
         }
-        
+
+        // check if the receiver has a specified radius and if the sender is in the receiver's range
+        if (t->specifiesRadius()
+                && !sender->rect.doesIntersect(t->getCenter(), t->getRadius())) {
+            continue;
+        }
+
+        telegram.recipients.push_back({delay, *listener});
     }
+    inRange.clear();
 
-    while (messagesToBePopped > 0) {
-        messages.pop_front();
-        messagesToBePopped--;
+    // stable, so that recipients with the same delay keep the order of the query
+    std::stable_sort(telegram.recipients.begin(), telegram.recipients.end(),
+                     [](const Telegram::Recipient& a, const Telegram::Recipient& b) {
+                         return a.delay < b.delay;
+                     });
+    telegram.hasRecipients = true;
+    telegram.cursor = 0;
+}
+
+/**
+ * Delivers a telegram to the recipients in its snapshot with the given
+ * delay, advancing the cursor of the snapshot past them.
+ *
+ * @param telegram the telegram to deliver
+ * @param delay the delay (in milliseconds) of the recipients to deliver to
+ */
+void Mailbox::deliverSnapshot(const TelegramPtr& telegram, Uint64 delay) {
+    std::vector<Telegram::Recipient>& recipients = telegram->recipients;
+    size_t& cursor = telegram->cursor;
+
+    while (cursor < recipients.size() && recipients[cursor].delay < delay) {
+        cursor++;
+    }
+
+    for (; cursor < recipients.size() && recipients[cursor].delay == delay; cursor++) {
+        Telegraph* t = recipients[cursor].listener.get();
+
+        // skip listeners that were removed or changed their delay since the dispatch
+        Uint64 current;
+        if (!listeners.getDelay(t, current) || current != delay) {
+            stats.dropped++;
+            continue;
+        }
+        stats.delivered++;
+        MSG_TRACE_SCOPE_ARG("Telegraph::handleMessage", mailboxTag);
+        t->handleMessage(telegram);
     }
 }
 
@@ -143,12 +229,28 @@ void Mailbox::update(std::shared_ptr<RTree> rtree) {
  *
  * @param sender the sender of the message (optional)
  * @param receiver the receiver of the message
+ * @param now The current time, in milliseconds on the dispatcher's clock.
  * @param extraInfo optional information, nullptr by default
  */
 void Mailbox::dispatchDirectMessage(const std::shared_ptr<Telegraph>&sender,
                               const std::shared_ptr<Telegraph>& receiver,
+                              Uint64 now,
                               const std::shared_ptr<void>& extraInfo) {
-    std::shared_ptr<Telegram> telegram = std::make_shared<Telegram>(extraInfo, sender);
+    dispatchDirectTelegram(pool->acquire(extraInfo, sender, now), receiver);
+}
+
+/**
+ * Directly dispatches a telegram that was already filled in to the receiver,
+ * without sending it to subscribers of the message code.
+ *
+ * @param telegram the telegram to dispatch
+ * @param receiver the receiver of the message
+ */
+void Mailbox::dispatchDirectTelegram(const TelegramPtr& telegram,
+                                     const std::shared_ptr<Telegraph>& receiver) {
+    stats.dispatched++;
+    stats.delivered++;
+    MSG_TRACE_SCOPE_ARG("Telegraph::handleMessage", mailboxTag);
     receiver->handleMessage(telegram);
 }
 
@@ -157,20 +259,85 @@ void Mailbox::dispatchDirectMessage(const std::shared_ptr<Telegraph>&sender,
  * with a reference to the sender of the message. Caller can optionally
  * attach extra information to the message.
  *
+ * If the mailbox was created with immediate delivery, listeners without a
+ * delay receive the message before this call returns.
+ *
  * The extra information can be of any type, but a destructor should be
  * defined in the class or passed as an argument to the shared_ptr constructor
  * resources can be deleted when the reference count is decremented to zero.
  *
  * @param extraInfo extra information attached to the message. Optional.
- * @param rtree The R-Tree on which to perform range queries.
+ * @param now The current time, in milliseconds on the dispatcher's clock.
+ * @param index The spatial index on which to perform range queries.
  * @param sender the sender of the message
  */
 void Mailbox::dispatchMessage(const std::shared_ptr<Telegraph>& sender,
-                              const std::shared_ptr<RTree> rtree,
+                              Uint64 now,
+                              const std::shared_ptr<SpatialIndex> index,
                               const std::shared_ptr<void>& extraInfo) {
-    std::shared_ptr<Telegram> telegram = std::make_shared<Telegram>(extraInfo, sender);
-    
-    messages.push_back(telegram);
+    // nobody would ever receive this telegram
+    if (listeners.empty()) {
+        stats.dispatched++;
+        stats.dropped++;
+        return;
+    }
+
+    dispatchTelegram(pool->acquire(extraInfo, sender, now), now, index);
+}
+
+/**
+ * Dispatches a telegram that the caller has already filled in to the
+ * listeners subscribed to the code of the mailbox. The telegram should come
+ * from the pool of this mailbox.
+ *
+ * @param telegram the telegram to dispatch
+ * @param now The current time, in milliseconds on the dispatcher's clock.
+ * @param index The spatial index on which to perform range queries.
+ */
+void Mailbox::dispatchTelegram(const TelegramPtr& telegram, Uint64 now,
+                               const std::shared_ptr<SpatialIndex>& index) {
+    stats.dispatched++;
+
+    const std::shared_ptr<Telegraph>& sender = telegram->sender;
+    if (options.snapshotRecipients && sender != nullptr && sender->specifiesRadius()) {
+        snapshotRecipients(*telegram, index);
+
+        // schedule one delivery for each distinct delay of the recipients
+        bool deliverNow = false;
+        const std::vector<Telegram::Recipient>& recipients = telegram->recipients;
+        for (size_t i = 0; i < recipients.size(); i++) {
+            Uint64 delay = recipients[i].delay;
+            if (i > 0 && recipients[i - 1].delay == delay) {
+                continue;
+            }
+            if (delay == 0 && options.immediateDelivery) {
+                deliverNow = true;
+            } else {
+                wheel.schedule({telegram, delay, now + delay});
+            }
+        }
+
+        if (deliverNow) {
+            deliver(telegram, 0, index);
+        }
+        return;
+    }
+
+    // schedule one delivery for each distinct delay
+    bool deliverNow = false;
+    for (const ListenerRegistry::Bucket& bucket : listeners.getBuckets()) {
+        if (bucket.delay == 0 && options.immediateDelivery) {
+            deliverNow = true;
+        } else {
+            wheel.schedule({telegram, bucket.delay, now + bucket.delay});
+        }
+    }
+
+    // listeners without a delay do not have to wait for the next update. This
+    // is done last, since the handlers may change the listeners.
+    if (deliverNow) {
+        deliver(telegram, 0, index);
+    }
 }
 
 /**
@@ -181,11 +348,12 @@ void Mailbox::dispatchMessage(const std::shared_ptr<Telegraph>& sender,
  * defined in the class or passed as an argument to the shared_ptr constructor
  * resources can be deleted when the reference count is decremented to zero.
  *
- * @param rtree The R-Tree on which to perform range queries.
+ * @param now The current time, in milliseconds on the dispatcher's clock.
+ * @param index The spatial index on which to perform range queries.
  * @param extraInfo extra information attached to the message. Optional and nullptr by default.
  */
-void Mailbox::dispatchMessage(const std::shared_ptr<RTree> rtree, const std::shared_ptr<void>& extraInfo) {
-    Mailbox::dispatchMessage(nullptr, rtree, extraInfo);
+void Mailbox::dispatchMessage(Uint64 now, const std::shared_ptr<SpatialIndex> index, const std::shared_ptr<void>& extraInfo) {
+    Mailbox::dispatchMessage(nullptr, now, index, extraInfo);
 }
 
 /**
@@ -200,8 +368,7 @@ void Mailbox::dispatchMessage(const std::shared_ptr<RTree> rtree, const std::sha
  * This is optional and there is no delay by default.
  */
 void Mailbox::addListener(const std::shared_ptr<Telegraph>& listener, Uint64 delay) {
-    listeners.emplace(delay, listener);
-    delays.emplace(listener, delay);
+    listeners.add(listener, delay);
 }
 
 /**
@@ -211,20 +378,24 @@ void Mailbox::addListener(const std::shared_ptr<Telegraph>& listener, Uint64 del
  * @param listener the listener to remove
  * */
 void Mailbox::removeListener(const std::shared_ptr<Telegraph>& listener) {
-    if (delays.find(listener) == delays.end()) return;
-
-    Uint64 delay = delays[listener];
-    // there could be multiple listeners with the same delay
-    auto range = listeners.equal_range(delay);
-    // iterate to see which listener we need to remove
-    for (auto it = range.first; it != range.second; ++it) {
-        if (it->second == listener) {
-            listeners.erase(it);
-            break;  // Stop after removing the first matching element
-        }
-    }
+    listeners.remove(listener.get());
+}
 
-    delays.erase(listener);
+/**
+ * Returns a snapshot of the statistics of this mailbox.
+ */
+MailboxStats Mailbox::getStats() const {
+    MailboxStats snapshot = stats;
+    snapshot.pending = wheel.size();
+    return snapshot;
+}
+
+/**
+ * Resets the counters and the lateness histogram of this mailbox. The
+ * number of pending deliveries is not affected.
+ */
+void Mailbox::resetStats() {
+    stats = MailboxStats();
 }
 
 
@@ -34,26 +34,60 @@
 
 
 #include "Telegraph.h"
-#include "Delay.h"
-#include <unordered_map>
-#include <map>
-#include <unordered_set>
-#include <queue>
-#include "rtree.h"
+#include "ListenerRegistry.h"
+#include "MailboxStats.h"
+#include "TelegramPool.h"
+#include "TimingWheel.h"
+#include <vector>
+#include "SpatialIndex.h"
+
+/**
+ * Options that change how a mailbox delivers its telegrams. All options are
+ * off by default.
+ */
+struct MailboxOptions {
+    /// whether listeners without a delay receive a telegram during the call to
+    /// dispatchMessage instead of in the next update. Telegrams are then only
+    /// queued if there is at least one listener with a delay.
+    bool immediateDelivery = false;
+
+    /// whether the listeners in range of a sender with a radius are resolved
+    /// once, when the message is dispatched, instead of with a range query every
+    /// time one of their delays expires. Listeners that move into range after
+    /// the dispatch do not receive the message, and listeners that are removed
+    /// before their delay expires still do not receive it.
+    bool snapshotRecipients = false;
+};
+
 class Mailbox {
 public:
     /**
      * Creates a mailbox.
+     *
+     * @param tag the message code of this mailbox
+     * @param pool the pool that telegrams are taken from
+     * @param options the delivery options of this mailbox
      */
-    Mailbox(int tag);
+    Mailbox(int tag, const std::shared_ptr<TelegramPool>& pool,
+            const MailboxOptions& options = MailboxOptions());
 
     /**
      * Updates the mailbox and sends delayed telegrams with an expired timestamp
      * to listeners.
      *
-     * @param rtree The R-Tree on which to perform range queries.
+     * @param now The current time, in milliseconds on the dispatcher's clock.
+     * @param index The spatial index on which to perform range queries.
      */
-    void update(std::shared_ptr<RTree> rtree);
+    void update(Uint64 now, std::shared_ptr<SpatialIndex> index);
+
+    /**
+     * Returns the time (in milliseconds on the dispatcher's clock) at which the
+     * next delivery of this mailbox is due, or TimingWheel::NEVER if nothing
+     * is pending.
+     */
+    Uint64 nextDeadline() const {
+        return wheel.nextDue();
+    }
 
     /**
      * Directly dispatches a message from the sender to the receiver, without
@@ -66,27 +100,44 @@ public:
      *
      * @param sender the sender of the message (optional)
      * @param receiver the receiver of the message
+     * @param now The current time, in milliseconds on the dispatcher's clock.
      * @param extraInfo optional information, nullptr by default
      */
     void dispatchDirectMessage(const std::shared_ptr<Telegraph>& sender,
                          const std::shared_ptr<Telegraph>& receiver,
+                         Uint64 now,
                          const std::shared_ptr<void>& extraInfo = nullptr);
 
+    /**
+     * Directly dispatches a telegram that was already filled in to the receiver,
+     * without sending it to subscribers of the message code.
+     *
+     * @param telegram the telegram to dispatch
+     * @param receiver the receiver of the message
+     */
+    void dispatchDirectTelegram(const TelegramPtr& telegram,
+                                const std::shared_ptr<Telegraph>& receiver);
+
     /**
      * Dispatches a message to the listeners subscribed to the code of the mailbox,
      * with a reference to the sender of the message. Caller can optionally
      * attach extra information to the message.
      *
+     * If the mailbox was created with immediate delivery, listeners without a
+     * delay receive the message before this call returns.
+     *
      * The extra information can be of any type, but a destructor should be
      * defined in the class or passed as an argument to the shared_ptr constructor
      * resources can be deleted when the reference count is decremented to zero.
      *
      * @param extraInfo extra information attached to the message. Optional.
      * @param sender the sender of the message
-     * @param rtree The R-Tree on which to perform range queries.
+     * @param now The current time, in milliseconds on the dispatcher's clock.
+     * @param index The spatial index on which to perform range queries.
      */
     void dispatchMessage(const std::shared_ptr<Telegraph>& sender,
-                         const std::shared_ptr<RTree> rtree,
+                         Uint64 now,
+                         const std::shared_ptr<SpatialIndex> index,
                          const std::shared_ptr<void>& extraInfo = nullptr);
 
     /**
@@ -97,9 +148,23 @@ public:
      * defined in the class or passed as an argument to the shared_ptr constructor
      * resources can be deleted when the reference count is decremented to zero.
      *
+     * @param now The current time, in milliseconds on the dispatcher's clock.
+     * @param index The spatial index on which to perform range queries.
      * @param extraInfo extra information attached to the message. Optional and nullptr by default.
      */
-    void dispatchMessage(const std::shared_ptr<RTree> rtree, const std::shared_ptr<void>& extraInfo = nullptr);
+    void dispatchMessage(Uint64 now, const std::shared_ptr<SpatialIndex> index, const std::shared_ptr<void>& extraInfo = nullptr);
+
+    /**
+     * Dispatches a telegram that the caller has already filled in to the
+     * listeners subscribed to the code of the mailbox. The telegram should come
+     * from the pool of this mailbox.
+     *
+     * @param telegram the telegram to dispatch
+     * @param now The current time, in milliseconds on the dispatcher's clock.
+     * @param index The spatial index on which to perform range queries.
+     */
+    void dispatchTelegram(const TelegramPtr& telegram, Uint64 now,
+                          const std::shared_ptr<SpatialIndex>& index);
 
     /**
      * Registers a listener with this mailbox. The caller can optionally add
@@ -123,23 +188,74 @@ public:
      * */
     void removeListener(const std::shared_ptr<Telegraph>&);
 
-    /// (for benchmarking) used to record the measured unwanted delays between
-    /// the time a message is dispatched and when it is actually sent to a
-    /// listener after subtracting the intended delay.
-//    std::vector<Delay> measuredDelays;
+    /**
+     * Returns a snapshot of the statistics of this mailbox.
+     */
+    MailboxStats getStats() const;
+
+    /**
+     * Resets the counters and the lateness histogram of this mailbox. The
+     * number of pending deliveries is not affected.
+     */
+    void resetStats();
 
 private:
     /// The tag corresponding to this Mailbox.
     int mailboxTag;
+
+    /// The delivery options of this Mailbox.
+    MailboxOptions options;
+
+    /// The pool that telegrams are taken from. Shared with the dispatcher
+    /// and the other mailboxes.
+    std::shared_ptr<TelegramPool> pool;
     
-    /// maps listeners to their delays if the delays are > 0
-    std::unordered_map<std::shared_ptr<Telegraph>, Uint64> delays;
+    /// the listeners of this mailbox, grouped in buckets by their delays
+    ListenerRegistry listeners;
 
-    /// maps delays in milliseconds to the set of listeners that have those delays
-    std::multimap<Uint64, std::shared_ptr<Telegraph>> listeners;
+    /// the statistics of this mailbox, except for the number of pending deliveries
+    MailboxStats stats;
 
-    /// a FIFO queue for messages in the order that they are first created.
-    /// Messages are popped once there are no more deliveries to be made.
-    std::deque<std::shared_ptr<Telegram>> messages;
+    /// schedules every telegram once for each distinct listener delay, in the
+    /// slot of the time at which the listeners with that delay should receive it.
+    /// Ticks are milliseconds on the dispatcher's clock.
+    TimingWheel wheel;
+
+    /// the deliveries that expired during the current update. Kept as a member
+    /// so that its memory is reused between updates.
+    std::vector<TimingWheel::Entry> expired;
+
+    /// the listeners in range of the sender of the telegram being delivered.
+    /// Kept as a member so that its memory is reused between queries.
+    std::vector<RTreeObject*> inRange;
+
+    /**
+     * Delivers a telegram to the listeners with the given delay. If the sender
+     * specified a radius, only the listeners in range receive the telegram.
+     *
+     * @param telegram the telegram to deliver
+     * @param delay the delay (in milliseconds) of the listeners to deliver to
+     * @param index The spatial index on which to perform range queries.
+     */
+    void deliver(const TelegramPtr& telegram, Uint64 delay,
+                 const std::shared_ptr<SpatialIndex>& index);
+
+    /**
+     * Resolves the listeners in range of the sender of a telegram and stores
+     * them in the telegram, sorted by delay.
+     *
+     * @param telegram the telegram to resolve the recipients of
+     * @param index The spatial index on which to perform range queries.
+     */
+    void snapshotRecipients(Telegram& telegram, const std::shared_ptr<SpatialIndex>& index);
+
+    /**
+     * Delivers a telegram to the recipients in its snapshot with the given
+     * delay, advancing the cursor of the snapshot past them.
+     *
+     * @param telegram the telegram to deliver
+     * @param delay the delay (in milliseconds) of the recipients to deliver to
+     */
+    void deliverSnapshot(const TelegramPtr& telegram, Uint64 delay);
 };
 #endif //CUGL_MAILBOX_H
@@ -0,0 +1,117 @@
+//
+//  MailboxStats.cpp
+//
+//  This class implements the statistics that a Mailbox keeps about its
+//  messages: counters of dispatched, delivered, pending and dropped messages,
+//  and a histogram of how late delayed deliveries are.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "MailboxStats.h"
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/** Returns the index of the highest set bit of x, which must not be 0. */
+static int highestBit(Uint64 x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+/** Creates an empty histogram. */
+LatencyHistogram::LatencyHistogram() {
+    clear();
+}
+
+/**
+ * Records a delivery.
+ *
+ * @param lateness how late the delivery was, in milliseconds
+ */
+void LatencyHistogram::record(Uint64 lateness) {
+    int bucket = lateness == 0 ? 0 : highestBit(lateness) + 1;
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+    buckets[bucket]++;
+    count++;
+    sum += lateness;
+    if (lateness > max) {
+        max = lateness;
+    }
+}
+
+/** Removes every recorded delivery. */
+void LatencyHistogram::clear() {
+    for (int i = 0; i < BUCKETS; i++) {
+        buckets[i] = 0;
+    }
+    count = 0;
+    sum = 0;
+    max = 0;
+}
+
+/**
+ * Returns the largest lateness (in milliseconds) counted by a bucket. For
+ * the last bucket this is the largest recorded lateness.
+ *
+ * @param bucket the index of the bucket
+ */
+Uint64 LatencyHistogram::getBucketLimit(int bucket) const {
+    if (bucket == BUCKETS - 1) {
+        return max;
+    }
+    return ((Uint64)1 << bucket) - 1;
+}
+
+/**
+ * Returns an upper bound on the given percentile of lateness, in
+ * milliseconds. The bound is the limit of the bucket that holds the
+ * percentile, so it is at most twice the actual value.
+ *
+ * @param p the percentile, between 0 and 100
+ */
+Uint64 LatencyHistogram::getPercentile(double p) const {
+    if (count == 0) return 0;
+
+    Uint64 rank = (Uint64)std::ceil(p / 100.0 * count);
+    if (rank < 1) rank = 1;
+
+    Uint64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            Uint64 limit = getBucketLimit(i);
+            return limit < max ? limit : max;
+        }
+    }
+    return max;
+}
@@ -0,0 +1,147 @@
+//
+//  MailboxStats.h
+//
+//  This class implements the statistics that a Mailbox keeps about its
+//  messages: counters of dispatched, delivered, pending and dropped messages,
+//  and a histogram of how late delayed deliveries are. They are always
+//  collected, in fixed memory and with a few increments per delivery, so that
+//  delivery lag can be watched in a release build through the snapshot API of
+//  the MessageDispatcher.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_MAILBOXSTATS_H
+#define CUGL_MAILBOXSTATS_H
+
+#include "CUGLShim.h"
+
+/**
+ * A histogram of lateness, the time between when a delivery was due and when
+ * it was actually made, in milliseconds on the dispatcher's clock.
+ *
+ * Bucket 0 counts deliveries that were on time, and bucket i counts
+ * deliveries that were between 2^(i-1) and 2^i - 1 milliseconds late. The
+ * last bucket also counts everything later than that.
+ */
+class LatencyHistogram {
+public:
+    /** The number of buckets. */
+    static constexpr int BUCKETS = 24;
+
+    /** Creates an empty histogram. */
+    LatencyHistogram();
+
+    /**
+     * Records a delivery.
+     *
+     * @param lateness how late the delivery was, in milliseconds
+     */
+    void record(Uint64 lateness);
+
+    /** Removes every recorded delivery. */
+    void clear();
+
+    /** Returns the number of recorded deliveries. */
+    Uint64 getCount() const {
+        return count;
+    }
+
+    /** Returns the total lateness of the recorded deliveries, in milliseconds. */
+    Uint64 getSum() const {
+        return sum;
+    }
+
+    /** Returns the largest recorded lateness, in milliseconds. */
+    Uint64 getMax() const {
+        return max;
+    }
+
+    /** Returns the average lateness, in milliseconds, or 0 if nothing was recorded. */
+    double getMean() const {
+        return count == 0 ? 0 : (double)sum / count;
+    }
+
+    /**
+     * Returns the number of deliveries in a bucket.
+     *
+     * @param bucket the index of the bucket
+     */
+    Uint64 getBucketCount(int bucket) const {
+        return buckets[bucket];
+    }
+
+    /**
+     * Returns the largest lateness (in milliseconds) counted by a bucket. For
+     * the last bucket this is the largest recorded lateness.
+     *
+     * @param bucket the index of the bucket
+     */
+    Uint64 getBucketLimit(int bucket) const;
+
+    /**
+     * Returns an upper bound on the given percentile of lateness, in
+     * milliseconds. The bound is the limit of the bucket that holds the
+     * percentile, so it is at most twice the actual value.
+     *
+     * @param p the percentile, between 0 and 100
+     */
+    Uint64 getPercentile(double p) const;
+
+private:
+    /// the number of deliveries in each bucket
+    Uint64 buckets[BUCKETS];
+
+    /// the number of recorded deliveries
+    Uint64 count;
+
+    /// the total lateness of the recorded deliveries
+    Uint64 sum;
+
+    /// the largest recorded lateness
+    Uint64 max;
+};
+
+/** A snapshot of the statistics of a Mailbox. */
+struct MailboxStats {
+    /// the number of messages dispatched to the mailbox, including direct messages
+    Uint64 dispatched = 0;
+
+    /// the number of times a listener received a message from the mailbox
+    Uint64 delivered = 0;
+
+    /// the number of delayed deliveries that are scheduled and not yet due,
+    /// one for each distinct delay of a message
+    Uint64 pending = 0;
+
+    /// the number of messages and recipients that were given up: messages
+    /// dispatched while the mailbox had no listeners, deliveries whose
+    /// listeners were all removed before they were due, and snapshot
+    /// recipients that were removed before their delay expired
+    Uint64 dropped = 0;
+
+    /// how late the scheduled deliveries were made
+    LatencyHistogram lateness;
+};
+
+#endif //CUGL_MAILBOXSTATS_H
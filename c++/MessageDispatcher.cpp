@@ -30,22 +30,96 @@
 //
 
 #include "MessageDispatcher.h"
+#include "Trace.h"
+#include <algorithm>
 
-MessageDispatcher::MessageDispatcher(float x, float y, float width, float height, int rTreeMaxPerLevel, int rTreeMinPerLevel, int rTreePadding) {
-    rtree = std::make_shared<RTree>(x, y, width, height, rTreeMaxPerLevel, rTreeMinPerLevel, rTreePadding);
+MessageDispatcher::MessageDispatcher(float x, float y, float width, float height, int rTreeMaxPerLevel, int rTreeMinPerLevel, int rTreePadding, int denseMailboxCodes, RTreeSplit rTreeSplit) {
+    rtree = std::make_shared<RTree>(x, y, width, height, rTreeMaxPerLevel, rTreeMinPerLevel, rTreePadding, rTreeSplit);
+    index = rtree;
+    pool = std::make_shared<TelegramPool>();
+    dense = denseMailboxCodes > 0;
+    if (dense) {
+        denseMailboxes.resize(denseMailboxCodes);
+    }
+}
+
+MessageDispatcher::MessageDispatcher(std::shared_ptr<SpatialIndex> index, int denseMailboxCodes) : index(index) {
+    rtree = std::dynamic_pointer_cast<RTree>(index);
+    pool = std::make_shared<TelegramPool>();
+    dense = denseMailboxCodes > 0;
+    if (dense) {
+        denseMailboxes.resize(denseMailboxCodes);
+    }
 }
 
 /**
- * Calls update on every mailbox, which then sends delayed telegrams with an
- * expired timestamp to listeners.
+ * Calls update on every mailbox with a delivery that is due, which then
+ * sends delayed telegrams with an expired timestamp to listeners. Mailboxes
+ * with nothing due are not touched.
  *
  * This method should be called regularly to ensure that delayed messages
  * are dispatched in a timely manner.
  */
 void MessageDispatcher::update() {
-    rtree->update();
-    for (auto &[msg, mailbox] : mailboxes) {
-        mailbox->update(rtree);
+    MSG_TRACE_SCOPE("MessageDispatcher::update");
+    clock.tick();
+    index->update();
+    Uint64 now = getTime();
+
+    // collect the due mailboxes first, so that messages dispatched by the
+    // handlers are delivered in the next update instead of this one
+    while (!deadlines.empty() && deadlines.top().first <= now) {
+        due.push_back(deadlines.top().second);
+        deadlines.pop();
+    }
+
+    for (int msg : due) {
+        Mailbox* mailbox = findMailbox(msg);
+        // the mailbox was removed, or an earlier entry already updated it
+        if (mailbox == nullptr || mailbox->nextDeadline() > now) {
+            continue;
+        }
+
+        // keep a hashed mailbox alive in case one of its handlers removes it
+        std::shared_ptr<Mailbox> keepAlive = dense ? nullptr : mailboxes[msg];
+        mailbox->update(now, index);
+        if (mailbox->nextDeadline() != NO_DEADLINE) {
+            deadlines.emplace(mailbox->nextDeadline(), msg);
+        }
+    }
+    due.clear();
+}
+
+/**
+ * Returns the time (see getTime()) at which the earliest pending delivery
+ * across all mailboxes is due, or NO_DEADLINE if nothing is pending.
+ *
+ * A loop that has nothing else to do can sleep until this time instead of
+ * calling update() every frame.
+ */
+Uint64 MessageDispatcher::nextDeadline() {
+    while (!deadlines.empty()) {
+        Mailbox* mailbox = findMailbox(deadlines.top().second);
+        if (mailbox != nullptr && mailbox->nextDeadline() == deadlines.top().first) {
+            return deadlines.top().first;
+        }
+        deadlines.pop();
+    }
+    return NO_DEADLINE;
+}
+
+/**
+ * Records the deadline of a mailbox in the heap if it moved earlier than
+ * the given previous deadline.
+ *
+ * @param msg the message code of the mailbox
+ * @param mailbox the mailbox
+ * @param previous the deadline of the mailbox before it was changed
+ */
+void MessageDispatcher::trackDeadline(int msg, const Mailbox& mailbox, Uint64 previous) {
+    Uint64 deadline = mailbox.nextDeadline();
+    if (deadline < previous) {
+        deadlines.emplace(deadline, msg);
     }
 }
 
@@ -54,10 +128,19 @@ void MessageDispatcher::update() {
  * already exist, the call will be a no-op.
  *
  * @param msg the message code
+ * @param options the delivery options of the mailbox. Optional.
+ * @throws std::out_of_range if the code does not fit in the dense mailbox table
  */
-void MessageDispatcher::addMailbox(int msg) {
-    if (mailboxes.find(msg) == mailboxes.end()) {
-        mailboxes.emplace(msg, std::make_shared<Mailbox>(msg));
+void MessageDispatcher::addMailbox(int msg, const MailboxOptions& options) {
+    if (dense) {
+        if (msg < 0 || msg >= (int)denseMailboxes.size()) {
+            throw std::out_of_range("message code " + std::to_string(msg) + " is outside the dense mailbox table");
+        }
+        if (!denseMailboxes[msg]) {
+            denseMailboxes[msg].emplace(msg, pool, options);
+        }
+    } else if (mailboxes.find(msg) == mailboxes.end()) {
+        mailboxes.emplace(msg, std::make_shared<Mailbox>(msg, pool, options));
     }
 }
 
@@ -67,7 +150,64 @@ void MessageDispatcher::addMailbox(int msg) {
  * @param msg the message code
  */
 void MessageDispatcher::removeMailbox(int msg) {
-    mailboxes.erase(msg);
+    if (dense) {
+        if (msg >= 0 && msg < (int)denseMailboxes.size()) {
+            denseMailboxes[msg].reset();
+        }
+    } else {
+        mailboxes.erase(msg);
+    }
+}
+
+/**
+ * Returns a snapshot of the statistics of the mailbox with the given
+ * message code.
+ *
+ * @param msg the message code
+ * @throws std::out_of_range if there is no mailbox with the code
+ */
+MailboxStats MessageDispatcher::getStats(int msg) {
+    return getMailbox(msg).getStats();
+}
+
+/**
+ * Returns a snapshot of the statistics of every mailbox, as pairs of
+ * message code and statistics, sorted by message code.
+ */
+std::vector<std::pair<int, MailboxStats>> MessageDispatcher::getStats() {
+    std::vector<std::pair<int, MailboxStats>> stats;
+    if (dense) {
+        for (int msg = 0; msg < (int)denseMailboxes.size(); msg++) {
+            if (denseMailboxes[msg]) {
+                stats.emplace_back(msg, denseMailboxes[msg]->getStats());
+            }
+        }
+    } else {
+        stats.reserve(mailboxes.size());
+        for (const auto& entry : mailboxes) {
+            stats.emplace_back(entry.first, entry.second->getStats());
+        }
+        std::sort(stats.begin(), stats.end(),
+                  [](const std::pair<int, MailboxStats>& a, const std::pair<int, MailboxStats>& b) {
+                      return a.first < b.first;
+                  });
+    }
+    return stats;
+}
+
+/**
+ * Resets the counters and lateness histograms of every mailbox.
+ */
+void MessageDispatcher::resetStats() {
+    if (dense) {
+        for (std::optional<Mailbox>& mailbox : denseMailboxes) {
+            if (mailbox) mailbox->resetStats();
+        }
+    } else {
+        for (auto& entry : mailboxes) {
+            entry.second->resetStats();
+        }
+    }
 }
 
 /**
@@ -85,7 +225,7 @@ void MessageDispatcher::removeMailbox(int msg) {
  * @param extraInfo optional information, nullptr by default
  */
 void MessageDispatcher::dispatchDirectMessage(const std::shared_ptr<Telegraph>& receiver, int msg, const std::shared_ptr<Telegraph>& sender, const std::shared_ptr<void>& extraInfo) {
-    mailboxes.at(msg)->dispatchDirectMessage(sender, receiver, extraInfo);
+    getMailbox(msg).dispatchDirectMessage(sender, receiver, getTime(), extraInfo);
 }
 
 /**
@@ -102,7 +242,10 @@ void MessageDispatcher::dispatchDirectMessage(const std::shared_ptr<Telegraph>&
  * @param extraInfo extra information attached to the message. Optional.
  */
 void MessageDispatcher::dispatchMessage(const std::shared_ptr<Telegraph>& sender, int msg, const std::shared_ptr<void>& extraInfo) {
-    mailboxes.at(msg)->dispatchMessage(sender, rtree, extraInfo);
+    Mailbox& mailbox = getMailbox(msg);
+    Uint64 previous = mailbox.nextDeadline();
+    mailbox.dispatchMessage(sender, getTime(), index, extraInfo);
+    trackDeadline(msg, mailbox, previous);
 }
 
 /**
@@ -117,7 +260,21 @@ void MessageDispatcher::dispatchMessage(const std::shared_ptr<Telegraph>& sender
  * @param extraInfo extra information attached to the message. Optional.
  */
 void MessageDispatcher::dispatchMessage(int msg, const std::shared_ptr<void>& extraInfo) {
-    mailboxes.at(msg)->dispatchMessage(rtree, extraInfo);
+    dispatchMessage(nullptr, msg, extraInfo);
+}
+
+/**
+ * Dispatches a telegram that was already filled in to the listeners of
+ * the given message code.
+ *
+ * @param msg the message code
+ * @param telegram the telegram to dispatch
+ */
+void MessageDispatcher::dispatchTelegram(int msg, const TelegramPtr& telegram) {
+    Mailbox& mailbox = getMailbox(msg);
+    Uint64 previous = mailbox.nextDeadline();
+    mailbox.dispatchTelegram(telegram, getTime(), index);
+    trackDeadline(msg, mailbox, previous);
 }
 
 /**
@@ -131,9 +288,9 @@ void MessageDispatcher::dispatchMessage(int msg, const std::shared_ptr<void>& ex
  * This is optional and there is no delay by default.
  */
 void MessageDispatcher::addListener(const std::shared_ptr<Telegraph>& listener, int msg, int delay) {
-    mailboxes.at(msg)->addListener(listener, delay);
+    getMailbox(msg).addListener(listener, delay);
     listener->addTag(msg);
-    rtree->insert(listener);
+    index->insert(listener);
 }
 
 /**
@@ -147,7 +304,7 @@ void MessageDispatcher::addListener(const std::shared_ptr<Telegraph>& listener,
 void MessageDispatcher::removeListener(const std::shared_ptr<Telegraph>& listener, int msg) {
     listener->removeTag(msg);
     if(!listener->subscribesToTag()){
-        rtree->remove(listener);
+        index->remove(listener);
     }
-    return mailboxes.at(msg)->removeListener(listener);
+    return getMailbox(msg).removeListener(listener);
 }
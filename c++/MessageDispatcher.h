@@ -33,30 +33,138 @@
 #define CUGL_MESSAGEDISPATCHER_H
 
 
+#include "FrameClock.h"
 #include "Mailbox.h"
+#include "TelegramPool.h"
 #include "Telegraph.h"
 #include "rtree.h"
+#include "SpatialHash.h"
+#include "UniformGrid.h"
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Whether extra information of type T is attached to a telegram by value. This
+ * is the case for everything except shared pointers, which are attached as
+ * extraInfo like before.
+ */
+template <typename T>
+struct IsInfoValue : std::true_type {};
+template <typename T>
+struct IsInfoValue<std::shared_ptr<T>> : std::false_type {};
+template <>
+struct IsInfoValue<std::nullptr_t> : std::false_type {};
 
 class MessageDispatcher {
 public:
-    MessageDispatcher(float x, float y, float width, float height, int rTreeMaxPerLevel = 5, int rTreeMinPerLevel = 2, int rTreePadding = 10);
+    /** The value returned by nextDeadline() when no delivery is pending. */
+    static constexpr Uint64 NO_DEADLINE = TimingWheel::NEVER;
+
+    /**
+     * Creates a dispatcher for objects in the given area.
+     *
+     * Message codes are usually small dense enums. If denseMailboxCodes is
+     * positive, mailboxes are stored by value in a table indexed by message
+     * code instead of a hash map, and only the codes 0 to denseMailboxCodes - 1
+     * can be used. In this mode a mailbox must not be removed by the handlers of
+     * its own messages.
+     *
+     * @param x The x-coordinate of the lower-left corner of the area.
+     * @param y The y-coordinate of the lower-left corner of the area.
+     * @param width The width of the area.
+     * @param height The height of the area.
+     * @param rTreeMaxPerLevel Maximum number of children per R-Tree node.
+     * @param rTreeMinPerLevel Minimum number of children per R-Tree node.
+     * @param rTreePadding The padding on each side of the bounding box of each object.
+     * @param denseMailboxCodes The number of message codes in the dense mailbox
+     * table, or 0 to store mailboxes in a hash map (default).
+     * @param rTreeSplit The algorithm the R-Tree uses to insert objects and split nodes.
+     */
+    MessageDispatcher(float x, float y, float width, float height, int rTreeMaxPerLevel = 5, int rTreeMinPerLevel = 2, int rTreePadding = 10, int denseMailboxCodes = 0, RTreeSplit rTreeSplit = RTreeSplit::LINEAR);
+
+    /**
+     * Creates a dispatcher that performs its range queries on the given
+     * spatial index, e.g. a UniformGrid or a SpatialHash instead of an R-Tree.
+     * The index must be empty, and is updated by the dispatcher from then on.
+     *
+     * @param index The spatial index of the listeners.
+     * @param denseMailboxCodes The number of message codes in the dense mailbox
+     * table, or 0 to store mailboxes in a hash map (default).
+     */
+    MessageDispatcher(std::shared_ptr<SpatialIndex> index, int denseMailboxCodes = 0);
+
     /**
-     * Calls update on every mailbox, which then sends delayed telegrams with an
-     * expired timestamp to listeners.
+     * Calls update on every mailbox with a delivery that is due, which then
+     * sends delayed telegrams with an expired timestamp to listeners. Mailboxes
+     * with nothing due are not touched.
      *
      * This method should be called regularly to ensure that delayed messages
      * are dispatched in a timely manner.
      */
     void update();
 
+    /**
+     * Returns the current time of the dispatcher, in milliseconds since it was
+     * created. Deadlines are measured on this clock.
+     *
+     * The clock is sampled once at the start of every update(), so this is the
+     * time of the current frame rather than the exact time of the call.
+     */
+    Uint64 getTime() const {
+        return clock.getTime();
+    }
+
+    /**
+     * Returns the clock of this dispatcher. Switch it to virtual time to run
+     * simulations faster than real time; it then only moves when advanced.
+     */
+    FrameClock& getClock() {
+        return clock;
+    }
+
+    /**
+     * Returns the R-Tree of the listeners of this dispatcher, e.g. to tune
+     * when it is reconstructed instead of updated incrementally.
+     *
+     * @return The R-Tree, or nullptr if the spatial index of the dispatcher
+     * is not an R-Tree.
+     */
+    RTree* getRTree() {
+        return rtree.get();
+    }
+
+    /**
+     * Returns the spatial index of the listeners of this dispatcher.
+     */
+    SpatialIndex& getSpatialIndex() {
+        return *index;
+    }
+
+    /**
+     * Returns the time (see getTime()) at which the earliest pending delivery
+     * across all mailboxes is due, or NO_DEADLINE if nothing is pending.
+     *
+     * A loop that has nothing else to do can sleep until this time instead of
+     * calling update() every frame.
+     */
+    Uint64 nextDeadline();
+
     /**
      * Adds a new mailbox with the given message code. If a mailbox with the code
      * already exist, the call will be a no-op.
      *
      * @param msg the message code
+     * @param options the delivery options of the mailbox. Optional.
      */
-    void addMailbox(int msg);
+    void addMailbox(int msg, const MailboxOptions& options = MailboxOptions());
 
     /**
      * Removes the mailbox with the given message code.
@@ -65,6 +173,26 @@ public:
      */
     void removeMailbox(int msg);
 
+    /**
+     * Returns a snapshot of the statistics of the mailbox with the given
+     * message code.
+     *
+     * @param msg the message code
+     * @throws std::out_of_range if there is no mailbox with the code
+     */
+    MailboxStats getStats(int msg);
+
+    /**
+     * Returns a snapshot of the statistics of every mailbox, as pairs of
+     * message code and statistics, sorted by message code.
+     */
+    std::vector<std::pair<int, MailboxStats>> getStats();
+
+    /**
+     * Resets the counters and lateness histograms of every mailbox.
+     */
+    void resetStats();
+
     /**
      * Directly dispatches a message from the sender to the receiver, without
      * sending it to subscribers of the message code.
@@ -84,6 +212,29 @@ public:
                          const std::shared_ptr<Telegraph>& sender = nullptr,
                          const std::shared_ptr<void>& extraInfo = nullptr);
 
+    /**
+     * Directly dispatches a message with a copy of the given value as extra
+     * information. Small trivially copyable values (see Telegram::storesInline)
+     * are stored inside the telegram without an allocation. The receiver can
+     * read the value with Telegram::getInfo.
+     *
+     * @param receiver the receiver of the message
+     * @param msg the message code
+     * @param sender the sender of the message. May be nullptr.
+     * @param info the extra information
+     */
+    template <typename T, typename std::enable_if<IsInfoValue<T>::value, int>::type = 0>
+    void dispatchDirectMessage(const std::shared_ptr<Telegraph>& receiver,
+                               int msg,
+                               const std::shared_ptr<Telegraph>& sender,
+                               const T& info) {
+        // like the other overload, this throws if there is no mailbox for msg
+        Mailbox& mailbox = getMailbox(msg);
+        TelegramPtr telegram = pool->acquire(nullptr, sender, getTime());
+        telegram->setInfo(info);
+        mailbox.dispatchDirectTelegram(telegram, receiver);
+    }
+
     /**
      * Dispatches a message with the given code to the listeners subscribed to
      * the code, with a reference to the sender of the message. Caller can
@@ -114,6 +265,36 @@ public:
      */
     void dispatchMessage(int msg, const std::shared_ptr<void>& extraInfo = nullptr);
 
+    /**
+     * Dispatches a message with the given code and a copy of the given value as
+     * extra information. Small trivially copyable values, such as a Vec2 or a
+     * float, are stored inside the telegram (see Telegram::storesInline), so
+     * no allocation is needed for them. Listeners read the value with
+     * Telegram::getInfo.
+     *
+     * @param sender the sender of the message. May be nullptr.
+     * @param msg the message code
+     * @param info the extra information
+     */
+    template <typename T, typename std::enable_if<IsInfoValue<T>::value, int>::type = 0>
+    void dispatchMessage(const std::shared_ptr<Telegraph>& sender, int msg, const T& info) {
+        TelegramPtr telegram = pool->acquire(nullptr, sender, getTime());
+        telegram->setInfo(info);
+        dispatchTelegram(msg, telegram);
+    }
+
+    /**
+     * Dispatches a message with the given code and a copy of the given value as
+     * extra information. See the version with a sender for details.
+     *
+     * @param msg the message code
+     * @param info the extra information
+     */
+    template <typename T, typename std::enable_if<IsInfoValue<T>::value, int>::type = 0>
+    void dispatchMessage(int msg, const T& info) {
+        dispatchMessage(nullptr, msg, info);
+    }
+
     /**
      * Registers a listener with the given message code. The caller can optionally add
      * a delay (in milliseconds) to the messages that the listener receives with
@@ -137,14 +318,87 @@ public:
      */
     void removeListener(const std::shared_ptr<Telegraph>& listener, int msg);
 
-    /// the rtree that is used for range queries when deciding who is in range
-    /// for messages. Shared between all the mailboxes.
+    /// the spatial index that is used for range queries when deciding who is
+    /// in range for messages. Shared between all the mailboxes.
+    std::shared_ptr<SpatialIndex> index;
+
+    /// the spatial index if it is an R-Tree, and nullptr otherwise
     std::shared_ptr<RTree> rtree;
 private:
-    /// maps message codes to mailboxes
+    /// a (deadline, message code) pair in the deadline heap
+    typedef std::pair<Uint64, int> Deadline;
+
+    /// the clock that deliveries are scheduled on. Sampled once per update.
+    FrameClock clock;
+
+    /// recycles the telegrams of all the mailboxes
+    std::shared_ptr<TelegramPool> pool;
+
+    /// maps message codes to mailboxes, unless the dense table is used
     std::unordered_map<int, std::shared_ptr<Mailbox>> mailboxes;
 
-    
+    /// the mailboxes indexed by message code, if the dense table is used. The
+    /// table never grows, so mailboxes never move.
+    std::vector<std::optional<Mailbox>> denseMailboxes;
+
+    /// whether the dense table is used
+    bool dense;
+
+    /**
+     * Returns the mailbox with the given message code, or nullptr if there is
+     * no such mailbox.
+     *
+     * @param msg the message code
+     */
+    Mailbox* findMailbox(int msg) {
+        if (dense) {
+            if (msg < 0 || msg >= (int)denseMailboxes.size() || !denseMailboxes[msg]) return nullptr;
+            return &*denseMailboxes[msg];
+        }
+        auto it = mailboxes.find(msg);
+        return it == mailboxes.end() ? nullptr : it->second.get();
+    }
+
+    /**
+     * Returns the mailbox with the given message code.
+     *
+     * @param msg the message code
+     * @throws std::out_of_range if there is no mailbox with the code
+     */
+    Mailbox& getMailbox(int msg) {
+        Mailbox* mailbox = findMailbox(msg);
+        if (mailbox == nullptr) {
+            throw std::out_of_range("no mailbox for message code " + std::to_string(msg));
+        }
+        return *mailbox;
+    }
+
+    /// a min-heap of the next deadline of every mailbox with pending deliveries.
+    /// A mailbox may have outdated entries in the heap as well; they are skipped
+    /// when they no longer match the deadline of the mailbox.
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+
+    /// the message codes of the mailboxes that are due in the current update
+    std::vector<int> due;
+
+    /**
+     * Records the deadline of a mailbox in the heap if it moved earlier than
+     * the given previous deadline.
+     *
+     * @param msg the message code of the mailbox
+     * @param mailbox the mailbox
+     * @param previous the deadline of the mailbox before it was changed
+     */
+    void trackDeadline(int msg, const Mailbox& mailbox, Uint64 previous);
+
+    /**
+     * Dispatches a telegram that was already filled in to the listeners of
+     * the given message code.
+     *
+     * @param msg the message code
+     * @param telegram the telegram to dispatch
+     */
+    void dispatchTelegram(int msg, const TelegramPtr& telegram);
 };
 
 #endif //CUGL_MESSAGEDISPATCHER_H
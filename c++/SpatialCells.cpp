@@ -0,0 +1,295 @@
+//
+//  SpatialCells.cpp
+//
+//  This class implements the part of a spatial index that is shared by the
+//  indices that bin objects into square cells by the centers of their bounding
+//  boxes. Moving an object to another cell takes constant time, and a search
+//  only visits the cells within its radius, plus the largest half-size of an
+//  object. Subclasses decide how the cells are stored.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+
+#include "SpatialCells.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Trace.h"
+
+/** The largest cell coordinate, so that ranges of coordinates do not overflow. */
+static const float MAX_CELL_COORDINATE = 1 << 30;
+
+/**
+ * Creates an empty index with cells of the given size.
+ *
+ * @param cellSize The length of the sides of the cells.
+ * @param originX The x-coordinate of the lower-left corner of cell (0, 0).
+ * @param originY The y-coordinate of the lower-left corner of cell (0, 0).
+ */
+SpatialCells::SpatialCells(float cellSize, float originX, float originY)
+    : cellSize(cellSize), originX(originX), originY(originY), maxHalfWidth(0), maxHalfHeight(0) {}
+
+/**
+ * Returns the column or row of the cell that contains a coordinate.
+ *
+ * @param v The coordinate.
+ * @param origin The coordinate of the corner of cell (0, 0).
+ */
+int SpatialCells::cellCoordinate(float v, float origin) const {
+    float c = std::floor((v - origin) / cellSize);
+    return (int)std::max(std::min(c, MAX_CELL_COORDINATE), -MAX_CELL_COORDINATE);
+}
+
+/**
+ * Adds an object to a cell.
+ *
+ * @param i The position of the object in objects.
+ * @param x The column of the cell.
+ * @param y The row of the cell.
+ */
+void SpatialCells::place(uint32_t i, int x, int y) {
+    uint32_t cell = getCell(x, y);
+    objectX[i] = x;
+    objectY[i] = y;
+    objectCells[i] = cell;
+    objectSlots[i] = (uint32_t)cells[cell].size();
+    cells[cell].push_back(i);
+}
+
+/**
+ * Removes an object from its cell.
+ *
+ * @param i The position of the object in objects.
+ */
+void SpatialCells::unplace(uint32_t i) {
+    std::vector<uint32_t> &cell = cells[objectCells[i]];
+    uint32_t last = cell.back();
+    cell[objectSlots[i]] = last;
+    objectSlots[last] = objectSlots[i];
+    cell.pop_back();
+    if (cell.empty()) {
+        releaseCell(objectCells[i]);
+    }
+}
+
+/**
+ * Moves the objects of a cell to another, empty cell.
+ *
+ * @param from The cell to move the objects from.
+ * @param to The cell to move the objects to.
+ */
+void SpatialCells::moveCell(uint32_t from, uint32_t to) {
+    cells[to].swap(cells[from]);
+    for (uint32_t i : cells[to]) {
+        objectCells[i] = to;
+    }
+}
+
+/**
+ * Calls a visitor on the objects that intersect a circle and have a tag,
+ * until it returns false.
+ *
+ * @param center The center of the circle.
+ * @param radius The radius of the circle.
+ * @param tag The tag of objects to visit (-1 for all objects).
+ * @param visitor The function to call on each object.
+ */
+template <typename Visitor>
+void SpatialCells::findIntersections(const Vec2 center, float radius, int tag, Visitor &visitor) {
+    // an object can reach into the circle from a cell up to half its size away
+    int minX = cellCoordinate(center.x - radius - maxHalfWidth, originX);
+    int maxX = cellCoordinate(center.x + radius + maxHalfWidth, originX);
+    int minY = cellCoordinate(center.y - radius - maxHalfHeight, originY);
+    int maxY = cellCoordinate(center.y + radius + maxHalfHeight, originY);
+    clampRange(minX, minY, maxX, maxY);
+    if (minX > maxX || minY > maxY) {
+        return;
+    }
+
+    auto visitCell = [&](const std::vector<uint32_t> &cell) {
+        for (uint32_t i : cell) {
+            const std::shared_ptr<RTreeObject> &obj = objects[i];
+            if (obj->rect.doesIntersect(center, radius) && obj->containsTag(tag) && !visitor(obj)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // a search larger than the occupied area visits every cell instead
+    if ((double)(maxX - minX + 1) * (maxY - minY + 1) > cells.size()) {
+        for (const std::vector<uint32_t> &cell : cells) {
+            if (!visitCell(cell)) {
+                return;
+            }
+        }
+        return;
+    }
+    for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            uint32_t cell = findCell(x, y);
+            if (cell != NO_CELL && !visitCell(cells[cell])) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Inserts an object into this index. Objects that are already in it are
+ * not inserted again.
+ *
+ * @param obj The object to insert.
+ */
+void SpatialCells::insert(std::shared_ptr<RTreeObject> obj) {
+    if (indices.find(obj.get()) != indices.end()) {
+        return;
+    }
+
+    uint32_t i;
+    if (freeObjects.empty()) {
+        i = (uint32_t)objects.size();
+        objects.push_back(obj);
+        objectX.push_back(0);
+        objectY.push_back(0);
+        objectCells.push_back(NO_CELL);
+        objectSlots.push_back(0);
+    } else {
+        i = freeObjects.back();
+        freeObjects.pop_back();
+        objects[i] = obj;
+    }
+    indices[obj.get()] = i;
+
+    const Rect &r = obj->rect;
+    maxHalfWidth = std::max(maxHalfWidth, r.size.width / 2);
+    maxHalfHeight = std::max(maxHalfHeight, r.size.height / 2);
+    place(i, cellCoordinate(r.getMidX(), originX), cellCoordinate(r.getMidY(), originY));
+}
+
+/**
+ * Removes an object from this index, if it is in it.
+ *
+ * @param obj The object to remove.
+ */
+void SpatialCells::remove(std::shared_ptr<RTreeObject> obj) {
+    auto it = indices.find(obj.get());
+    if (it == indices.end()) {
+        return;
+    }
+    uint32_t i = it->second;
+    indices.erase(it);
+    unplace(i);
+    objects[i] = nullptr;
+    freeObjects.push_back(i);
+}
+
+/**
+ * Moves the objects whose centers left their cells to their new cells.
+ */
+void SpatialCells::update() {
+    MSG_TRACE_SCOPE("SpatialCells::update");
+    maxHalfWidth = 0;
+    maxHalfHeight = 0;
+    for (uint32_t i = 0; i < objects.size(); i++) {
+        if (objects[i] == nullptr) {
+            continue;
+        }
+        const Rect &r = objects[i]->rect;
+        maxHalfWidth = std::max(maxHalfWidth, r.size.width / 2);
+        maxHalfHeight = std::max(maxHalfHeight, r.size.height / 2);
+
+        int x = cellCoordinate(r.getMidX(), originX);
+        int y = cellCoordinate(r.getMidY(), originY);
+        if (x != objectX[i] || y != objectY[i]) {
+            unplace(i);
+            place(i, x, y);
+        }
+    }
+}
+
+/**
+ * Removes all objects from this index.
+ */
+void SpatialCells::clear() {
+    for (std::vector<uint32_t> &cell : cells) {
+        cell.clear();
+    }
+    objects.clear();
+    freeObjects.clear();
+    indices.clear();
+    objectX.clear();
+    objectY.clear();
+    objectCells.clear();
+    objectSlots.clear();
+    maxHalfWidth = 0;
+    maxHalfHeight = 0;
+}
+
+/**
+ * Searches for objects within a given circular area that have the given tag.
+ *
+ * @param center The center of the circle to search.
+ * @param radius The radius of the circle to search.
+ * @param tag The tag of objects to return (-1 for all objects).
+ * @return A vector of shared pointers to the objects intersecting the area.
+ */
+std::vector<std::shared_ptr<RTreeObject>> SpatialCells::search(const Vec2 center, float radius, int tag) {
+    MSG_TRACE_SCOPE_ARG("SpatialCells::search", tag);
+    std::vector<std::shared_ptr<RTreeObject>> res;
+    auto collect = [&res](const std::shared_ptr<RTreeObject> &obj) {
+        res.push_back(obj);
+        return true;
+    };
+    findIntersections(center, radius, tag, collect);
+    return res;
+}
+
+/**
+ * Searches for objects within a given circular area that have the given
+ * tag, storing raw pointers to them in a buffer owned by the caller. The
+ * buffer is cleared first.
+ *
+ * @param center The center of the circle to search.
+ * @param radius The radius of the circle to search.
+ * @param tag The tag of objects to return (-1 for all objects).
+ * @param res The buffer to store the objects in.
+ * @param maxResults The number of objects after which the search stops.
+ * @return The number of objects found.
+ */
+size_t SpatialCells::search(const Vec2 center, float radius, int tag, std::vector<RTreeObject*> &res,
+                            size_t maxResults) {
+    MSG_TRACE_SCOPE_ARG("SpatialCells::search", tag);
+    res.clear();
+    if (maxResults == 0) {
+        return 0;
+    }
+    auto collect = [&res, maxResults](const std::shared_ptr<RTreeObject> &obj) {
+        res.push_back(obj.get());
+        return res.size() < maxResults;
+    };
+    findIntersections(center, radius, tag, collect);
+    return res.size();
+}
@@ -0,0 +1,246 @@
+//
+//  SpatialCells.h
+//
+//  This class implements the part of a spatial index that is shared by the
+//  indices that bin objects into square cells by the centers of their bounding
+//  boxes. Moving an object to another cell takes constant time, and a search
+//  only visits the cells within its radius, plus the largest half-size of an
+//  object. Subclasses decide how the cells are stored.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+
+#ifndef SPATIALCELLS_H
+#define SPATIALCELLS_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "SpatialIndex.h"
+#include "rtreeobject.h"
+#include "CUGLShim.h"
+
+using namespace cugl;
+
+class SpatialCells : public SpatialIndex {
+protected:
+    /** The cell index that refers to no cell. */
+    static constexpr uint32_t NO_CELL = UINT32_MAX;
+
+    /** The length of the sides of the cells. */
+    float cellSize;
+
+    /** The x-coordinate of the lower-left corner of cell (0, 0). */
+    float originX;
+
+    /** The y-coordinate of the lower-left corner of cell (0, 0). */
+    float originY;
+
+    /** The objects in each cell, as positions in objects. */
+    std::vector<std::vector<uint32_t>> cells;
+
+    /**
+     * Returns the cell with the given coordinates, creating it if it does
+     * not exist.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    virtual uint32_t getCell(int x, int y) = 0;
+
+    /**
+     * Returns the cell with the given coordinates, or NO_CELL if it does not
+     * exist.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    virtual uint32_t findCell(int x, int y) const = 0;
+
+    /**
+     * Limits a range of cell coordinates to the cells that objects can be in.
+     *
+     * @param minX The first column of the range.
+     * @param minY The first row of the range.
+     * @param maxX The last column of the range.
+     * @param maxY The last row of the range.
+     */
+    virtual void clampRange(int &minX, int &minY, int &maxX, int &maxY) const = 0;
+
+    /**
+     * Called when the last object leaves a cell. Does nothing by default, so
+     * that empty cells are kept.
+     */
+    virtual void releaseCell(uint32_t /*cell*/) {}
+
+    /**
+     * Moves the objects of a cell to another, empty cell.
+     *
+     * @param from The cell to move the objects from.
+     * @param to The cell to move the objects to.
+     */
+    void moveCell(uint32_t from, uint32_t to);
+
+private:
+    /** The objects in this index, with nullptr for removed objects. */
+    std::vector<std::shared_ptr<RTreeObject>> objects;
+
+    /** The positions in objects of removed objects, which are reused first. */
+    std::vector<uint32_t> freeObjects;
+
+    /** The position of every object in objects. */
+    std::unordered_map<const RTreeObject*, uint32_t> indices;
+
+    /** The column of the cell of each object. */
+    std::vector<int> objectX;
+
+    /** The row of the cell of each object. */
+    std::vector<int> objectY;
+
+    /** The cell of each object. */
+    std::vector<uint32_t> objectCells;
+
+    /** The position of each object in its cell. */
+    std::vector<uint32_t> objectSlots;
+
+    /** Half of the largest width of an object at the last update. */
+    float maxHalfWidth;
+
+    /** Half of the largest height of an object at the last update. */
+    float maxHalfHeight;
+
+    /**
+     * Returns the column or row of the cell that contains a coordinate.
+     *
+     * @param v The coordinate.
+     * @param origin The coordinate of the corner of cell (0, 0).
+     */
+    int cellCoordinate(float v, float origin) const;
+
+    /**
+     * Adds an object to a cell.
+     *
+     * @param i The position of the object in objects.
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    void place(uint32_t i, int x, int y);
+
+    /**
+     * Removes an object from its cell.
+     *
+     * @param i The position of the object in objects.
+     */
+    void unplace(uint32_t i);
+
+    /**
+     * Calls a visitor on the objects that intersect a circle and have a tag,
+     * until it returns false.
+     *
+     * @param center The center of the circle.
+     * @param radius The radius of the circle.
+     * @param tag The tag of objects to visit (-1 for all objects).
+     * @param visitor The function to call on each object.
+     */
+    template <typename Visitor>
+    void findIntersections(const Vec2 center, float radius, int tag, Visitor &visitor);
+
+public:
+    /**
+     * Creates an empty index with cells of the given size.
+     *
+     * @param cellSize The length of the sides of the cells.
+     * @param originX The x-coordinate of the lower-left corner of cell (0, 0).
+     * @param originY The y-coordinate of the lower-left corner of cell (0, 0).
+     */
+    SpatialCells(float cellSize, float originX, float originY);
+
+    /**
+     * Returns the length of the sides of the cells.
+     */
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    /**
+     * Returns the number of objects in this index.
+     */
+    size_t size() const {
+        return indices.size();
+    }
+
+    /**
+     * Inserts an object into this index. Objects that are already in it are
+     * not inserted again.
+     *
+     * @param obj The object to insert.
+     */
+    void insert(std::shared_ptr<RTreeObject> obj) override;
+
+    /**
+     * Removes an object from this index, if it is in it.
+     *
+     * @param obj The object to remove.
+     */
+    void remove(std::shared_ptr<RTreeObject> obj) override;
+
+    /**
+     * Moves the objects whose centers left their cells to their new cells.
+     */
+    void update() override;
+
+    /**
+     * Removes all objects from this index.
+     */
+    void clear() override;
+
+    /**
+     * Searches for objects within a given circular area that have the given tag.
+     *
+     * @param center The center of the circle to search.
+     * @param radius The radius of the circle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @return A vector of shared pointers to the objects intersecting the area.
+     */
+    std::vector<std::shared_ptr<RTreeObject>> search(const Vec2 center, float radius, int tag) override;
+
+    /**
+     * Searches for objects within a given circular area that have the given
+     * tag, storing raw pointers to them in a buffer owned by the caller. The
+     * buffer is cleared first.
+     *
+     * @param center The center of the circle to search.
+     * @param radius The radius of the circle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @param res The buffer to store the objects in.
+     * @param maxResults The number of objects after which the search stops.
+     * @return The number of objects found.
+     */
+    size_t search(const Vec2 center, float radius, int tag, std::vector<RTreeObject*> &res,
+                  size_t maxResults = SIZE_MAX) override;
+};
+
+#endif
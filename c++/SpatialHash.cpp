@@ -0,0 +1,97 @@
+//
+//  SpatialHash.cpp
+//
+//  This class implements a spatial index that bins objects into square cells
+//  that are created when an object first enters them, and found by hashing
+//  their coordinates. Unlike a UniformGrid, it needs no bounds, but looking a
+//  cell up costs a hash lookup. Cells are kept until the index is cleared.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+
+#include "SpatialHash.h"
+
+/**
+ * Creates an empty spatial hash.
+ *
+ * @param cellSize The length of the sides of the cells, e.g. the most
+ * common search radius.
+ */
+SpatialHash::SpatialHash(float cellSize) : SpatialCells(cellSize, 0, 0) {}
+
+/**
+ * Returns the cell with the given coordinates, creating it if it does
+ * not exist.
+ *
+ * @param x The column of the cell.
+ * @param y The row of the cell.
+ */
+uint32_t SpatialHash::getCell(int x, int y) {
+    auto it = cellIndices.emplace(key(x, y), (uint32_t)cells.size());
+    if (it.second) {
+        cells.emplace_back();
+        cellKeys.push_back(key(x, y));
+    }
+    return it.first->second;
+}
+
+/**
+ * Returns the cell with the given coordinates, or NO_CELL if it does not
+ * exist.
+ *
+ * @param x The column of the cell.
+ * @param y The row of the cell.
+ */
+uint32_t SpatialHash::findCell(int x, int y) const {
+    auto it = cellIndices.find(key(x, y));
+    return it == cellIndices.end() ? NO_CELL : it->second;
+}
+
+/**
+ * Erases a cell that its last object left, moving the last cell into its
+ * place.
+ *
+ * @param cell The empty cell.
+ */
+void SpatialHash::releaseCell(uint32_t cell) {
+    uint32_t last = (uint32_t)cells.size() - 1;
+    cellIndices.erase(cellKeys[cell]);
+    if (cell != last) {
+        moveCell(last, cell);
+        cellKeys[cell] = cellKeys[last];
+        cellIndices[cellKeys[cell]] = cell;
+    }
+    cells.pop_back();
+    cellKeys.pop_back();
+}
+
+/**
+ * Removes all objects and cells from this index.
+ */
+void SpatialHash::clear() {
+    SpatialCells::clear();
+    cells.clear();
+    cellKeys.clear();
+    cellIndices.clear();
+}
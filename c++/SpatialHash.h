@@ -0,0 +1,107 @@
+//
+//  SpatialHash.h
+//
+//  This class implements a spatial index that bins objects into square cells
+//  that are created when an object first enters them, and found by hashing
+//  their coordinates. Unlike a UniformGrid, it needs no bounds, but looking a
+//  cell up costs a hash lookup. Cells are erased when their last object leaves.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "SpatialCells.h"
+
+class SpatialHash : public SpatialCells {
+private:
+    /** The position in cells of every cell that was created. */
+    std::unordered_map<uint64_t, uint32_t> cellIndices;
+
+    /** The key of each cell. */
+    std::vector<uint64_t> cellKeys;
+
+    /**
+     * Returns the key of the cell with the given coordinates.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    static uint64_t key(int x, int y) {
+        return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+    }
+
+protected:
+    /**
+     * Returns the cell with the given coordinates, creating it if it does
+     * not exist.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    uint32_t getCell(int x, int y) override;
+
+    /**
+     * Returns the cell with the given coordinates, or NO_CELL if it does not
+     * exist.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    uint32_t findCell(int x, int y) const override;
+
+    /**
+     * Does nothing, since objects can be in any cell.
+     */
+    void clampRange(int & /*minX*/, int & /*minY*/, int & /*maxX*/, int & /*maxY*/) const override {}
+
+    /**
+     * Erases a cell that its last object left, moving the last cell into its
+     * place.
+     *
+     * @param cell The empty cell.
+     */
+    void releaseCell(uint32_t cell) override;
+
+public:
+    /**
+     * Creates an empty spatial hash.
+     *
+     * @param cellSize The length of the sides of the cells, e.g. the most
+     * common search radius.
+     */
+    SpatialHash(float cellSize);
+
+    /**
+     * Removes all objects and cells from this index.
+     */
+    void clear() override;
+};
+
+#endif
@@ -0,0 +1,107 @@
+//
+//  SpatialIndex.h
+//
+//  This class is the interface of the spatial indices that a MessageDispatcher
+//  uses to find the listeners in range of a sender. The RTree is one of them;
+//  UniformGrid and SpatialHash bin objects into cells instead, so updating
+//  them costs the same no matter how the objects are distributed.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rtreeobject.h"
+#include "CUGLShim.h"
+
+using namespace cugl;
+
+class SpatialIndex {
+public:
+    /**
+     * Deletes this spatial index.
+     */
+    virtual ~SpatialIndex() {}
+
+    /**
+     * Inserts an object into this index. Objects that are already in it are
+     * not inserted again.
+     *
+     * @param obj The object to insert.
+     */
+    virtual void insert(std::shared_ptr<RTreeObject> obj) = 0;
+
+    /**
+     * Removes an object from this index, if it is in it.
+     *
+     * @param obj The object to remove.
+     */
+    virtual void remove(std::shared_ptr<RTreeObject> obj) = 0;
+
+    /**
+     * Updates this index after its objects moved. Searches only find moved
+     * objects at their new positions after this is called.
+     */
+    virtual void update() = 0;
+
+    /**
+     * Removes all objects from this index.
+     */
+    virtual void clear() = 0;
+
+    /**
+     * Searches for objects within a given circular area that have the given tag.
+     *
+     * @param center The center of the circle to search.
+     * @param radius The radius of the circle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @return A vector of shared pointers to the objects intersecting the area.
+     */
+    virtual std::vector<std::shared_ptr<RTreeObject>> search(const Vec2 center, float radius, int tag) = 0;
+
+    /**
+     * Searches for objects within a given circular area that have the given
+     * tag, storing raw pointers to them in a buffer owned by the caller. The
+     * buffer is cleared first, so reusing it across queries does not allocate.
+     *
+     * The pointers are only valid while the objects stay in the index.
+     *
+     * @param center The center of the circle to search.
+     * @param radius The radius of the circle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @param res The buffer to store the objects in.
+     * @param maxResults The number of objects after which the search stops.
+     * @return The number of objects found.
+     */
+    virtual size_t search(const Vec2 center, float radius, int tag, std::vector<RTreeObject*> &res,
+                          size_t maxResults = SIZE_MAX) = 0;
+};
+
+#endif
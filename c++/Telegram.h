@@ -32,29 +32,47 @@
 #define CUGL_TELEGRAM_H
 
 #include <chrono>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <memory>
-#include <cugl/cugl.h>
+#include "CUGLShim.h"
 
 using namespace cugl;
 
 // forward declaration of the Telegraph class to eliminate circular include
 // dependency.
 class Telegraph;
+class TelegramPool;
+class TelegramPtr;
 class Telegram {
 
 public:
+    /// the number of bytes of extra information that can be stored inside the
+    /// telegram without a separate allocation
+    static constexpr size_t INLINE_INFO_SIZE = 48;
+
+    /**
+     * Returns whether extra information of type T is stored inside the
+     * telegram. This is the case for small trivially copyable types, such as
+     * a Vec2 or a float.
+     */
+    template <typename T>
+    static constexpr bool storesInline() {
+        return std::is_trivially_copyable<T>::value && sizeof(T) <= INLINE_INFO_SIZE
+            && alignof(T) <= alignof(std::max_align_t);
+    }
+
     /**
      * Creates and initializes a Telegram.
      *
-     * The time this telegram is sent and the last time this telegram has been
-     * checked for deliveries are set as the current time.
+     * The time this telegram is sent is set by the dispatcher, from the clock
+     * that it samples once per frame.
      */
-     Telegram() {
-        timeSent = Timestamp();
-        lastUpdate = Timestamp(timeSent);
-    }
+    Telegram() {}
 
     /**
      * Creates a Telegram with extra information.
@@ -91,18 +109,184 @@ public:
         this->sender = sender;
     }
 
-    /// the time at which dispatchMessage is called by the sender and this telegram is created.
-    Timestamp timeSent;
+    /// the time at which dispatchMessage is called by the sender, in milliseconds
+    /// on the clock of the dispatcher.
+    Uint64 timeSent = 0;
 
-    /// the last time we checked this telegram for messages to dispatch.
-    /// Used to keep track of which listeners we still have to dispatch to.
-    Timestamp lastUpdate;
-
-    /// optional extra information that is associated with this telegram.
+    /// optional extra information that is associated with this telegram. Not
+    /// used for extra information that is stored inside the telegram.
     std::shared_ptr<void> extraInfo = nullptr;
 
     /// sender of this telegram. Optional.
     std::shared_ptr<Telegraph> sender = nullptr;
+
+    /**
+     * Attaches a copy of the given value as extra information. Values for which
+     * storesInline() is true are stored inside the telegram; larger values are
+     * copied into extraInfo.
+     *
+     * @param info the extra information to attach
+     */
+    template <typename T>
+    void setInfo(const T& info) {
+        if constexpr (storesInline<T>()) {
+            new (inlineInfo) T(info);
+            hasInlineInfo = true;
+            extraInfo = nullptr;
+        } else {
+            extraInfo = std::make_shared<T>(info);
+            hasInlineInfo = false;
+        }
+    }
+
+    /**
+     * Returns the extra information as a T, or nullptr if there is none. T
+     * must be the type of the extra information that was attached.
+     *
+     * This works for values attached with setInfo() as well as for extraInfo.
+     */
+    template <typename T>
+    const T* getInfo() const {
+        if (hasInlineInfo) {
+            return std::launder(reinterpret_cast<const T*>(inlineInfo));
+        }
+        return static_cast<const T*>(extraInfo.get());
+    }
+
+    // telegrams are shared through TelegramPtr handles and are never copied
+    Telegram(const Telegram&) = delete;
+    Telegram& operator=(const Telegram&) = delete;
+
+private:
+    /// the storage for small extra information. Only trivially copyable values
+    /// are stored here, so they never need to be destroyed.
+    alignas(std::max_align_t) unsigned char inlineInfo[INLINE_INFO_SIZE];
+
+    /// whether the extra information is stored in inlineInfo
+    bool hasInlineInfo = false;
+
+    /** A listener that was in range of the sender when the telegram was dispatched. */
+    struct Recipient {
+        /** The delay (in milliseconds) of the listener. */
+        Uint64 delay;
+        /** The listener. */
+        std::shared_ptr<Telegraph> listener;
+    };
+
+    /// whether the recipients were resolved when this telegram was dispatched
+    bool hasRecipients = false;
+
+    /// the recipients resolved at dispatch, sorted by delay
+    std::vector<Recipient> recipients;
+
+    /// the first recipient that has not received this telegram yet
+    size_t cursor = 0;
+
+    /// the number of TelegramPtr handles that refer to this telegram. This is
+    /// not atomic, since messages are dispatched from a single thread.
+    unsigned int refCount = 0;
+
+    /// the pool that this telegram is returned to once it is no longer
+    /// referenced, or nullptr if it should be deleted instead.
+    TelegramPool* pool = nullptr;
+
+    /// the next telegram in the free list of the pool, while this telegram
+    /// is not in use.
+    Telegram* nextFree = nullptr;
+
+    /**
+     * Returns this telegram to its pool, or deletes it if it has no pool.
+     * Called when the last handle to this telegram is released.
+     */
+    void recycle();
+
+    friend class Mailbox;
+    friend class TelegramPool;
+    friend class TelegramPtr;
+};
+
+/**
+ * A handle to a Telegram with an intrusive reference count. Copying a handle
+ * only increments a plain counter in the telegram, and a telegram goes back
+ * to its pool once the last handle to it is released.
+ *
+ * Handlers receive telegrams by const reference, so delivering a telegram
+ * does not touch the reference count at all. A handler that wants to keep a
+ * telegram after it returns can simply copy the handle.
+ */
+class TelegramPtr {
+public:
+    /** Creates an empty handle. */
+    TelegramPtr() : telegram(nullptr) {}
+
+    /** Creates an empty handle. */
+    TelegramPtr(std::nullptr_t) : telegram(nullptr) {}
+
+    /**
+     * Creates a handle to the given telegram. Telegrams created with new that
+     * are not part of a pool are deleted once the last handle is released.
+     *
+     * @param telegram the telegram to refer to
+     */
+    explicit TelegramPtr(Telegram* telegram) : telegram(telegram) {
+        if (telegram != nullptr) telegram->refCount++;
+    }
+
+    TelegramPtr(const TelegramPtr& other) : TelegramPtr(other.telegram) {}
+
+    TelegramPtr(TelegramPtr&& other) noexcept : telegram(other.telegram) {
+        other.telegram = nullptr;
+    }
+
+    TelegramPtr& operator=(const TelegramPtr& other) {
+        TelegramPtr(other).swap(*this);
+        return *this;
+    }
+
+    TelegramPtr& operator=(TelegramPtr&& other) noexcept {
+        TelegramPtr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~TelegramPtr() {
+        if (telegram != nullptr && --telegram->refCount == 0) {
+            telegram->recycle();
+        }
+    }
+
+    /** Swaps the telegrams of two handles. */
+    void swap(TelegramPtr& other) noexcept {
+        std::swap(telegram, other.telegram);
+    }
+
+    /** Returns the telegram this handle refers to, or nullptr if it is empty. */
+    Telegram* get() const {
+        return telegram;
+    }
+
+    Telegram* operator->() const {
+        return telegram;
+    }
+
+    Telegram& operator*() const {
+        return *telegram;
+    }
+
+    explicit operator bool() const {
+        return telegram != nullptr;
+    }
+
+    bool operator==(const TelegramPtr& other) const {
+        return telegram == other.telegram;
+    }
+
+    bool operator!=(const TelegramPtr& other) const {
+        return telegram != other.telegram;
+    }
+
+private:
+    /// the telegram this handle refers to
+    Telegram* telegram;
 };
 
 
@@ -0,0 +1,114 @@
+//
+//  TelegramPool.cpp
+//
+//  This class implements a TelegramPool object. The pool is owned by the
+//  MessageDispatcher and recycles telegrams through a free list, so that
+//  dispatching a message does not allocate once the pool has grown to the
+//  number of telegrams in flight.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "TelegramPool.h"
+
+/**
+ * Returns this telegram to its pool, or deletes it if it has no pool.
+ * Called when the last handle to this telegram is released.
+ */
+void Telegram::recycle() {
+    if (pool != nullptr) {
+        pool->release(this);
+    } else {
+        delete this;
+    }
+}
+
+/**
+ * Creates an empty pool.
+ */
+TelegramPool::TelegramPool() : freeList(nullptr), free(0) {}
+
+/**
+ * Deletes every telegram that is not in use. Telegrams that are still
+ * referenced are detached from the pool and deleted by their last handle.
+ */
+TelegramPool::~TelegramPool() {
+    for (Telegram* telegram : telegrams) {
+        if (telegram->refCount == 0) {
+            delete telegram;
+        } else {
+            telegram->pool = nullptr;
+        }
+    }
+}
+
+/**
+ * Returns a telegram from the pool with the given extra information,
+ * sender and time.
+ *
+ * @param extraInfo Extra information that is attached to the telegram
+ * @param sender The sender of the telegram. Optional.
+ * @param timeSent The time the telegram is sent, in milliseconds on the
+ * clock of the dispatcher.
+ * @return a handle to the telegram
+ */
+TelegramPtr TelegramPool::acquire(const std::shared_ptr<void>& extraInfo,
+                                  const std::shared_ptr<Telegraph>& sender,
+                                  Uint64 timeSent) {
+    Telegram* telegram = freeList;
+    if (telegram != nullptr) {
+        freeList = telegram->nextFree;
+        telegram->nextFree = nullptr;
+        free--;
+    } else {
+        telegram = new Telegram();
+        telegram->pool = this;
+        telegrams.push_back(telegram);
+    }
+
+    telegram->extraInfo = extraInfo;
+    telegram->sender = sender;
+    telegram->timeSent = timeSent;
+    return TelegramPtr(telegram);
+}
+
+/**
+ * Returns a telegram that is no longer referenced to the free list.
+ *
+ * @param telegram the telegram to return
+ */
+void TelegramPool::release(Telegram* telegram) {
+    // let go of the payload and the sender as soon as nobody needs them
+    telegram->extraInfo = nullptr;
+    telegram->hasInlineInfo = false;
+    telegram->sender = nullptr;
+
+    // keep the capacity of the snapshot for the next telegram
+    telegram->hasRecipients = false;
+    telegram->recipients.clear();
+    telegram->cursor = 0;
+
+    telegram->nextFree = freeList;
+    freeList = telegram;
+    free++;
+}
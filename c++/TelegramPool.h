@@ -0,0 +1,100 @@
+//
+//  TelegramPool.h
+//
+//  This class implements a TelegramPool object. The pool is owned by the
+//  MessageDispatcher and recycles telegrams through a free list, so that
+//  dispatching a message does not allocate once the pool has grown to the
+//  number of telegrams in flight.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_TELEGRAMPOOL_H
+#define CUGL_TELEGRAMPOOL_H
+
+#include <memory>
+#include <vector>
+#include "Telegram.h"
+
+class TelegramPool {
+public:
+    /**
+     * Creates an empty pool.
+     */
+    TelegramPool();
+
+    /**
+     * Deletes every telegram that is not in use. Telegrams that are still
+     * referenced are detached from the pool and deleted by their last handle.
+     */
+    ~TelegramPool();
+
+    // telegrams point back to their pool, so it cannot be copied
+    TelegramPool(const TelegramPool&) = delete;
+    TelegramPool& operator=(const TelegramPool&) = delete;
+
+    /**
+     * Returns a telegram from the pool with the given extra information,
+     * sender and time.
+     *
+     * @param extraInfo Extra information that is attached to the telegram
+     * @param sender The sender of the telegram. Optional.
+     * @param timeSent The time the telegram is sent, in milliseconds on the
+     * clock of the dispatcher.
+     * @return a handle to the telegram
+     */
+    TelegramPtr acquire(const std::shared_ptr<void>& extraInfo,
+                        const std::shared_ptr<Telegraph>& sender,
+                        Uint64 timeSent);
+
+    /** Returns the number of telegrams owned by this pool. */
+    size_t size() const {
+        return telegrams.size();
+    }
+
+    /** Returns the number of telegrams that are waiting to be reused. */
+    size_t available() const {
+        return free;
+    }
+
+private:
+    /// every telegram owned by this pool, in use or not
+    std::vector<Telegram*> telegrams;
+
+    /// the first telegram of the free list
+    Telegram* freeList;
+
+    /// the number of telegrams in the free list
+    size_t free;
+
+    /**
+     * Returns a telegram that is no longer referenced to the free list.
+     *
+     * @param telegram the telegram to return
+     */
+    void release(Telegram* telegram);
+
+    friend class Telegram;
+};
+
+#endif //CUGL_TELEGRAMPOOL_H
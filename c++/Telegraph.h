@@ -6,6 +6,10 @@
 //  send or receive ranges.
 //
 //  Subclasses should override the handleMessage function and equals operator.
+//  handleMessage takes a const TelegramPtr& instead of a std::shared_ptr<Telegram>
+//  since telegrams are pooled, so handlers written against the old signature no
+//  longer override it and are never called. Mark handlers with override so that
+//  such a mismatch fails to compile.
 //
 //  CUGL MIT License:
 //      This software is provided 'as-is', without any express or implied
@@ -96,9 +100,15 @@ public:
      * Objects that inherit from this class should override this method with their
      * own handler.
      *
+     * The message is shared with the other receivers and recycled once nobody
+     * refers to it anymore. Copy the handle to keep the message after returning.
+     *
+     * Subclasses should mark their handler override, so that a signature that
+     * does not match fails to compile instead of never being called.
+     *
      * @param msg The message delivered to the telegraph
      */
-    virtual void handleMessage(const std::shared_ptr<Telegram> msg) {
+    virtual void handleMessage(const TelegramPtr& /*msg*/) {
      };
 
     virtual bool operator==(const Telegraph& other) const {
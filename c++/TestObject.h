@@ -18,7 +18,7 @@ public:
         velY = static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / 0.2));
     };
     
-    void handleMessage(const std::shared_ptr<Telegram> msg) {
+    void handleMessage(const TelegramPtr& /*msg*/) override {
         wasAlerted = true;
     }
     
@@ -33,6 +33,7 @@ public:
         rect.origin.y += velY;
     }
     
+#ifndef MSG_HEADLESS
     void draw(const std::shared_ptr<SpriteBatch>& batch) {
         if(wasAlerted){
             batch->setColor(Color4::RED);
@@ -46,4 +47,5 @@ public:
         batch->outline(r);
         wasAlerted = false;
     }
+#endif
 };
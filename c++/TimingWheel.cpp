@@ -0,0 +1,216 @@
+//
+//  TimingWheel.cpp
+//
+//  This class implements a hierarchical timing wheel, which is used by a Mailbox
+//  to schedule delayed deliveries. Every (telegram, delay) pair is placed in the
+//  slot where it becomes due, so advancing the wheel only touches the entries
+//  that actually expire instead of every pending telegram.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "TimingWheel.h"
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/** Returns the index of the lowest set bit of x. x must not be zero. */
+static int lowestBit(Uint64 x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+/** Returns the index of the highest set bit of x. x must not be zero. */
+static int highestBit(Uint64 x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+/**
+ * Creates an empty timing wheel.
+ *
+ * @param start The tick that the wheel starts at.
+ */
+TimingWheel::TimingWheel(Uint64 start) : current(start), count(0), slots(LEVELS * SLOTS), occupied() {}
+
+/**
+ * Schedules an entry. Entries that are already due will be returned by the
+ * next call to advance().
+ *
+ * @param entry The entry to schedule.
+ */
+void TimingWheel::schedule(Entry entry) {
+    count++;
+    place(std::move(entry));
+}
+
+/**
+ * Places an entry in the slot where it becomes due relative to the
+ * current tick, or in the ready list if it is already due.
+ *
+ * @param entry The entry to place.
+ */
+void TimingWheel::place(Entry &&entry) {
+    if (entry.due <= current) {
+        ready.push_back(std::move(entry));
+        return;
+    }
+
+    // The entry goes on the level of the highest digit in which its due tick
+    // differs from the current tick. That digit is always ahead of the
+    // current one, so every occupied slot of a level is still in the future.
+    int level = highestBit(entry.due ^ current) / BITS;
+    if (level >= LEVELS) {
+        overflow.push_back(std::move(entry));
+        return;
+    }
+
+    int slot = (entry.due >> (level * BITS)) & (SLOTS - 1);
+    slots[level * SLOTS + slot].push_back(std::move(entry));
+    occupied[level] |= (Uint64)1 << slot;
+}
+
+/**
+ * Moves the wheel to the given tick, moving entries of the slots that
+ * contain the tick down to the lower levels.
+ *
+ * Precondition: no entry is due before tick.
+ *
+ * @param tick The tick to move to.
+ */
+void TimingWheel::moveTo(Uint64 tick) {
+    Uint64 previous = current;
+    current = tick;
+
+    // entries that did not fit on the wheel may fit now
+    if (!overflow.empty() && (previous >> (LEVELS * BITS)) != (tick >> (LEVELS * BITS))) {
+        std::vector<Entry> far;
+        far.swap(overflow);
+        for (Entry &entry : far) {
+            place(std::move(entry));
+        }
+    }
+
+    // Any occupied slot that contains the new tick must be spread over the
+    // lower levels. Since nothing is due before tick, every other occupied
+    // slot is still ahead of it and can stay where it is.
+    std::vector<Entry> cascade;
+    for (int level = LEVELS - 1; level > 0; level--) {
+        int slot = (tick >> (level * BITS)) & (SLOTS - 1);
+        if (occupied[level] & ((Uint64)1 << slot)) {
+            occupied[level] &= ~((Uint64)1 << slot);
+            cascade.swap(slots[level * SLOTS + slot]);
+            for (Entry &entry : cascade) {
+                place(std::move(entry));
+            }
+            cascade.clear();
+        }
+    }
+
+    int slot = tick & (SLOTS - 1);
+    if (occupied[0] & ((Uint64)1 << slot)) {
+        occupied[0] &= ~((Uint64)1 << slot);
+        std::vector<Entry> &entries = slots[slot];
+        for (Entry &entry : entries) {
+            ready.push_back(std::move(entry));
+        }
+        entries.clear();
+    }
+}
+
+/**
+ * Advances the wheel to the given tick and appends every entry that is due
+ * at or before that tick to out, in the order in which they became due.
+ *
+ * @param now The tick to advance to.
+ * @param out The vector to append expired entries to.
+ */
+void TimingWheel::advance(Uint64 now, std::vector<Entry> &out) {
+    while (true) {
+        if (!ready.empty()) {
+            count -= ready.size();
+            for (Entry &entry : ready) {
+                out.push_back(std::move(entry));
+            }
+            ready.clear();
+        }
+
+        // jump straight to the next tick with entries instead of stepping
+        // through the empty ones
+        Uint64 next = nextDue();
+        if (next > now) {
+            break;
+        }
+        moveTo(next);
+    }
+
+    if (now > current) {
+        moveTo(now);
+    }
+}
+
+/**
+ * Returns the earliest tick at which an entry is due, or NEVER if the wheel
+ * is empty.
+ */
+Uint64 TimingWheel::nextDue() const {
+    if (!ready.empty()) {
+        return current;
+    }
+
+    // entries on a lower level are always due before entries on a higher one
+    for (int level = 0; level < LEVELS; level++) {
+        if (occupied[level] == 0) {
+            continue;
+        }
+
+        int slot = lowestBit(occupied[level]);
+        if (level == 0) {
+            return (current & ~(Uint64)(SLOTS - 1)) | slot;
+        }
+
+        Uint64 earliest = NEVER;
+        for (const Entry &entry : slots[level * SLOTS + slot]) {
+            earliest = std::min(earliest, entry.due);
+        }
+        return earliest;
+    }
+
+    Uint64 earliest = NEVER;
+    for (const Entry &entry : overflow) {
+        earliest = std::min(earliest, entry.due);
+    }
+    return earliest;
+}
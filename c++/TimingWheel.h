@@ -0,0 +1,144 @@
+//
+//  TimingWheel.h
+//
+//  This class implements a hierarchical timing wheel, which is used by a Mailbox
+//  to schedule delayed deliveries. Every (telegram, delay) pair is placed in the
+//  slot where it becomes due, so advancing the wheel only touches the entries
+//  that actually expire instead of every pending telegram.
+//
+//  The wheel counts time in integer ticks (milliseconds for a Mailbox). Level 0
+//  has one slot per tick, and every level above it has slots that are 64 times
+//  as wide as the level below. Entries are moved down a level as the wheel
+//  reaches the slot that holds them.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_TIMINGWHEEL_H
+#define CUGL_TIMINGWHEEL_H
+
+#include <memory>
+#include <vector>
+#include "Telegram.h"
+
+class TimingWheel {
+public:
+    /** A single scheduled delivery of a telegram. */
+    struct Entry {
+        /** The telegram to deliver. */
+        TelegramPtr telegram;
+        /** The delay (in ticks) of the listeners this entry is delivered to. */
+        Uint64 delay;
+        /** The tick at which this entry becomes due. */
+        Uint64 due;
+    };
+
+    /** The value returned by nextDue() when nothing is scheduled. */
+    static constexpr Uint64 NEVER = UINT64_MAX;
+
+    /**
+     * Creates an empty timing wheel.
+     *
+     * @param start The tick that the wheel starts at.
+     */
+    explicit TimingWheel(Uint64 start = 0);
+
+    /**
+     * Schedules an entry. Entries that are already due will be returned by the
+     * next call to advance().
+     *
+     * @param entry The entry to schedule.
+     */
+    void schedule(Entry entry);
+
+    /**
+     * Advances the wheel to the given tick and appends every entry that is due
+     * at or before that tick to out, in the order in which they became due.
+     *
+     * @param now The tick to advance to.
+     * @param out The vector to append expired entries to.
+     */
+    void advance(Uint64 now, std::vector<Entry> &out);
+
+    /**
+     * Returns the earliest tick at which an entry is due, or NEVER if the wheel
+     * is empty.
+     */
+    Uint64 nextDue() const;
+
+    /** Returns the number of entries that are scheduled. */
+    size_t size() const {
+        return count;
+    }
+
+    /** Returns whether no entries are scheduled. */
+    bool empty() const {
+        return count == 0;
+    }
+
+private:
+    /** The number of bits of a tick that are handled by each level. */
+    static constexpr int BITS = 6;
+    /** The number of slots per level. */
+    static constexpr int SLOTS = 1 << BITS;
+    /** The number of levels. Six levels cover 2^36 ticks (over two years of milliseconds). */
+    static constexpr int LEVELS = 6;
+
+    /** The last tick the wheel has advanced to. */
+    Uint64 current;
+
+    /** The number of scheduled entries. */
+    size_t count;
+
+    /** The slots of every level, stored level after level. */
+    std::vector<std::vector<Entry>> slots;
+
+    /** For every level, a bitmask of the slots that are not empty. */
+    Uint64 occupied[LEVELS];
+
+    /** Entries that are already due but have not been returned yet. */
+    std::vector<Entry> ready;
+
+    /** Entries that are too far in the future to fit on the wheel. */
+    std::vector<Entry> overflow;
+
+    /**
+     * Places an entry in the slot where it becomes due relative to the
+     * current tick, or in the ready list if it is already due.
+     *
+     * @param entry The entry to place.
+     */
+    void place(Entry &&entry);
+
+    /**
+     * Moves the wheel to the given tick, moving entries of the slots that
+     * contain the tick down to the lower levels.
+     *
+     * Precondition: no entry is due before tick.
+     *
+     * @param tick The tick to move to.
+     */
+    void moveTo(Uint64 tick);
+};
+
+#endif //CUGL_TIMINGWHEEL_H
@@ -0,0 +1,119 @@
+//
+//  Trace.cpp
+//
+//  This class implements a Tracer, which records timed spans of the phases of
+//  the MessageDispatcher and the RTree in a fixed-size ring buffer, and
+//  exports them as Chrome trace-event JSON.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#include "Trace.h"
+#include <cstdio>
+#include <fstream>
+
+/**
+ * Returns the tracer that the MSG_TRACE_SCOPE macros record to.
+ */
+Tracer& Tracer::get() {
+    static Tracer tracer;
+    return tracer;
+}
+
+/**
+ * Creates a tracer that keeps the given number of most recent spans.
+ *
+ * @param capacity the number of spans in the ring buffer
+ */
+Tracer::Tracer(size_t capacity) : origin(Clock::now()), next(0), wrapped(false) {
+    spans.resize(capacity > 0 ? capacity : 1);
+}
+
+/** Removes every span from the buffer. */
+void Tracer::clear() {
+    next = 0;
+    wrapped = false;
+}
+
+/**
+ * Changes the number of spans kept in the buffer. This removes every span.
+ *
+ * @param capacity the number of spans in the ring buffer
+ */
+void Tracer::setCapacity(size_t capacity) {
+    spans.assign(capacity > 0 ? capacity : 1, Span());
+    clear();
+}
+
+/**
+ * Returns the spans in the buffer, from the oldest to the most recently
+ * completed one.
+ */
+std::vector<Tracer::Span> Tracer::getSpans() const {
+    std::vector<Span> result;
+    result.reserve(size());
+    if (wrapped) {
+        result.insert(result.end(), spans.begin() + next, spans.end());
+    }
+    result.insert(result.end(), spans.begin(), spans.begin() + next);
+    return result;
+}
+
+/**
+ * Writes the spans in the buffer as Chrome trace-event JSON.
+ *
+ * @param out the stream to write to
+ */
+void Tracer::writeChromeTrace(std::ostream& out) const {
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char buffer[64];
+    for (const Span& span : getSpans()) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+
+        // span names are string literals from this library, so they need no escaping
+        out << "{\"name\":\"" << span.name << "\",\"cat\":\"msg\",\"ph\":\"X\",\"pid\":1,\"tid\":1";
+        std::snprintf(buffer, sizeof(buffer), ",\"ts\":%.3f,\"dur\":%.3f",
+                      span.start / 1000.0, span.duration / 1000.0);
+        out << buffer;
+        if (span.arg != NO_ARG) {
+            out << ",\"args\":{\"code\":" << span.arg << "}";
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+}
+
+/**
+ * Writes the spans in the buffer as Chrome trace-event JSON to a file.
+ *
+ * @param path the path of the file
+ * @return whether the file was written
+ */
+bool Tracer::writeChromeTrace(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+    writeChromeTrace(out);
+    return static_cast<bool>(out);
+}
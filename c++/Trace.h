@@ -0,0 +1,200 @@
+//
+//  Trace.h
+//
+//  This class implements a Tracer, which records timed spans of the phases of
+//  the MessageDispatcher and the RTree (tree checks, rebuilds, mailbox updates,
+//  range queries and message handlers) in a fixed-size ring buffer. The spans
+//  can be exported as Chrome trace-event JSON and opened in chrome://tracing
+//  or Perfetto to see where the time of a slow frame went.
+//
+//  Spans are only recorded when the code is compiled with MSG_TRACE defined.
+//  Otherwise the MSG_TRACE_SCOPE macros compile to nothing, and the Tracer
+//  stays empty.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Alice Sze
+//  Version: 12/14/2023
+//
+
+#ifndef CUGL_TRACE_H
+#define CUGL_TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "CUGLShim.h"
+
+class Tracer {
+public:
+    /** The message code of a span that does not belong to a message code. */
+    static constexpr int NO_ARG = -1;
+
+    /** A completed span. */
+    struct Span {
+        /** The name of the span. Must be a string literal. */
+        const char* name;
+        /** The message code that the span belongs to, or NO_ARG. */
+        int arg;
+        /** The start of the span, in nanoseconds since the tracer was created. */
+        Uint64 start;
+        /** The duration of the span, in nanoseconds. */
+        Uint64 duration;
+    };
+
+    /**
+     * Returns the tracer that the MSG_TRACE_SCOPE macros record to.
+     */
+    static Tracer& get();
+
+    /**
+     * Creates a tracer that keeps the given number of most recent spans.
+     *
+     * @param capacity the number of spans in the ring buffer
+     */
+    explicit Tracer(size_t capacity = 65536);
+
+    /**
+     * Returns the current time, in nanoseconds since this tracer was created.
+     */
+    Uint64 now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count();
+    }
+
+    /**
+     * Records a completed span, overwriting the oldest span if the buffer
+     * is full.
+     *
+     * @param name the name of the span. Must be a string literal.
+     * @param arg the message code of the span, or NO_ARG
+     * @param start the start of the span, from now()
+     * @param end the end of the span, from now()
+     */
+    void record(const char* name, int arg, Uint64 start, Uint64 end) {
+        spans[next] = {name, arg, start, end - start};
+        next++;
+        if (next == spans.size()) {
+            next = 0;
+            wrapped = true;
+        }
+    }
+
+    /** Returns the number of spans in the buffer. */
+    size_t size() const {
+        return wrapped ? spans.size() : next;
+    }
+
+    /** Removes every span from the buffer. */
+    void clear();
+
+    /**
+     * Changes the number of spans kept in the buffer. This removes every span.
+     *
+     * @param capacity the number of spans in the ring buffer
+     */
+    void setCapacity(size_t capacity);
+
+    /**
+     * Returns the spans in the buffer, from the oldest to the most recently
+     * completed one.
+     */
+    std::vector<Span> getSpans() const;
+
+    /**
+     * Writes the spans in the buffer as Chrome trace-event JSON.
+     *
+     * @param out the stream to write to
+     */
+    void writeChromeTrace(std::ostream& out) const;
+
+    /**
+     * Writes the spans in the buffer as Chrome trace-event JSON to a file.
+     *
+     * @param path the path of the file
+     * @return whether the file was written
+     */
+    bool writeChromeTrace(const std::string& path) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /// the moment from which span times are measured
+    Clock::time_point origin;
+
+    /// the ring buffer of spans
+    std::vector<Span> spans;
+
+    /// the index at which the next span is recorded
+    size_t next;
+
+    /// whether the buffer has been filled at least once
+    bool wrapped;
+};
+
+/**
+ * Records a span from its creation to the end of its scope. Use the
+ * MSG_TRACE_SCOPE macros instead, so that the span disappears when tracing
+ * is compiled out.
+ */
+class TraceScope {
+public:
+    /**
+     * Starts a span.
+     *
+     * @param name the name of the span. Must be a string literal.
+     * @param arg the message code of the span. Optional.
+     */
+    explicit TraceScope(const char* name, int arg = Tracer::NO_ARG)
+    : name(name), arg(arg), start(Tracer::get().now()) {}
+
+    /** Ends the span and records it. */
+    ~TraceScope() {
+        Tracer& tracer = Tracer::get();
+        tracer.record(name, arg, start, tracer.now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    /// the name of the span
+    const char* name;
+    /// the message code of the span
+    int arg;
+    /// the start of the span
+    Uint64 start;
+};
+
+#define MSG_TRACE_CONCAT_(a, b) a##b
+#define MSG_TRACE_CONCAT(a, b) MSG_TRACE_CONCAT_(a, b)
+
+#ifdef MSG_TRACE
+/** Records a span with the given name until the end of the enclosing scope. */
+#define MSG_TRACE_SCOPE(name) TraceScope MSG_TRACE_CONCAT(traceScope, __LINE__)(name)
+/** Records a span with the given name and message code until the end of the enclosing scope. */
+#define MSG_TRACE_SCOPE_ARG(name, arg) TraceScope MSG_TRACE_CONCAT(traceScope, __LINE__)(name, arg)
+#else
+#define MSG_TRACE_SCOPE(name) ((void)0)
+#define MSG_TRACE_SCOPE_ARG(name, arg) ((void)0)
+#endif
+
+#endif //CUGL_TRACE_H
@@ -0,0 +1,93 @@
+//
+//  UniformGrid.h
+//
+//  This class implements a spatial index that bins objects into a fixed grid of
+//  square cells over an area. Objects outside of the area are kept in the
+//  cells at its border. A grid suits many objects of similar size that move
+//  every frame, since moving an object takes constant time.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+
+#ifndef UNIFORMGRID_H
+#define UNIFORMGRID_H
+
+#include "SpatialCells.h"
+
+class UniformGrid : public SpatialCells {
+private:
+    /** The number of columns of cells. */
+    int columns;
+
+    /** The number of rows of cells. */
+    int rows;
+
+protected:
+    /**
+     * Returns the cell with the given coordinates, clamped to the grid.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    uint32_t getCell(int x, int y) override {
+        return findCell(x, y);
+    }
+
+    /**
+     * Returns the cell with the given coordinates, clamped to the grid.
+     *
+     * @param x The column of the cell.
+     * @param y The row of the cell.
+     */
+    uint32_t findCell(int x, int y) const override {
+        x = x < 0 ? 0 : (x >= columns ? columns - 1 : x);
+        y = y < 0 ? 0 : (y >= rows ? rows - 1 : y);
+        return (uint32_t)(y * columns + x);
+    }
+
+    /**
+     * Limits a range of cell coordinates to the grid.
+     *
+     * @param minX The first column of the range.
+     * @param minY The first row of the range.
+     * @param maxX The last column of the range.
+     * @param maxY The last row of the range.
+     */
+    void clampRange(int &minX, int &minY, int &maxX, int &maxY) const override;
+
+public:
+    /**
+     * Creates an empty grid over the given area.
+     *
+     * @param x The x-coordinate of the lower-left corner of the area.
+     * @param y The y-coordinate of the lower-left corner of the area.
+     * @param width The width of the area.
+     * @param height The height of the area.
+     * @param cellSize The length of the sides of the cells, e.g. the most
+     * common search radius.
+     */
+    UniformGrid(float x, float y, float width, float height, float cellSize);
+};
+
+#endif
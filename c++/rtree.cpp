@@ -30,149 +30,284 @@
 
 #include "rtree.h"
 
-#include <cugl/cugl.h>
+#include "CUGLShim.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include "rtreenode.h"
 #include "rtreeobject.h"
+#include "Trace.h"
 
 using namespace cugl;
+
+/** How much of the distance an object moved in the last update goes into its smoothed speed. */
+static const float PADDING_SMOOTHING = 0.25f;
+
+/** How many times the padding an object needs its box may have before it is shrunk. */
+static const float OVERSIZED_PADDING = 2.0f;
+
+/**
+ * The fraction of the largest padding below which extra padding is not worth
+ * a reinsertion, since the smoothed speed of a stopped object only decays.
+ */
+static const float MIN_SHRUNK_PADDING = 1.0f / 64;
+
+/**
+ * Returns the padding on each side of the bounding box of an object: the
+ * distance it moves in paddingUpdates updates with adaptive padding, and
+ * bufferSize otherwise.
+ *
+ * @param slot The slot of the object.
+ */
+float RTree::getPadding(RTreeIndex slot) const {
+    if (!adaptivePadding) {
+        return bufferSize;
+    }
+    const Vec2 *velocity = objects[slot]->getVelocity();
+    float speed = velocity == nullptr ? speeds[slot]
+                                      : std::max(std::abs(velocity->x), std::abs(velocity->y));
+    return std::min(speed * paddingUpdates, maxPadding);
+}
+
 /**
- * Fills a vector with objects in a subtree that intersect with a given
- * circular area and subscribe to a given tag.
+ * Returns the bounding box of an object in this RTree, which is the box
+ * of the object padded on each side.
+ *
+ * @param slot The slot of the object.
+ */
+RTreeBox RTree::getContainer(RTreeIndex slot) const {
+    float padding = getPadding(slot);
+    RTreeBox box(objects[slot]->rect);
+    return RTreeBox(box.minX - padding, box.minY - padding, box.maxX + padding, box.maxY + padding);
+}
+
+/**
+ * Recomputes the tag masks of a subtree from its objects.
  *
  * @param n The root of the subtree.
- * @param center The center of the circle.
- * @param radius The radius of the circle.
- * @param tag
- * @param res Vector containing objects that intersect the area.
- */
-void RTree::findIntersections(RTreeNode &n, const Vec2 center, float radius, int tag,
-                            std::vector<std::shared_ptr<RTreeObject>> &res) {
-    if (n.level == 0) {
-        for (auto &child : n.children) {
-            if (child->obj->rect.doesIntersect(center, radius)
-                    && child->obj->containsTag(tag)) {
-                res.push_back(child->obj);
+ * @return The union of the tag masks of the children of the root.
+ */
+uint64_t RTree::refreshTags(RTreeIndex n) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        RTreeIndex child = nodes.getChild(n, i);
+        uint64_t tags = nodes[n].level == 0 ? getObjectTags(child) : refreshTags(child);
+        nodes.setChildTags(n, i, tags);
+        mask |= tags;
+    }
+    return mask;
+}
+
+/**
+ * Adds the bits of tags that were added to an object to the tag masks of
+ * the nodes above it.
+ *
+ * @param obj The slot of the object.
+ * @param bits The bits of the tags.
+ */
+void RTree::addObjectTag(RTreeIndex obj, uint64_t bits) {
+    addTagHelper(root, obj, boxes[obj], bits);
+    // the tree being built in the background has the masks of its snapshot
+    tagsAddedDuringBuild = tagsAddedDuringBuild || building;
+}
+
+/**
+ * Searches for an object in a given node, and if it is found, adds the bits
+ * of tags to the tag masks of the path to it.
+ *
+ * @param n The node to search.
+ * @param obj The slot of the object.
+ * @param containerBox The bounding box of the object.
+ * @param bits The bits of the tags.
+ * @return true if the object was found.
+ */
+bool RTree::addTagHelper(RTreeIndex n, RTreeIndex obj, const RTreeBox &containerBox, uint64_t bits) {
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        RTreeIndex child = nodes.getChild(n, i);
+        // the bounding box of every ancestor of the object contains its bounding box
+        bool found = nodes[n].level == 0
+                     ? child == obj
+                     : nodes.getChildBox(n, i).contains(containerBox) && addTagHelper(child, obj, containerBox, bits);
+        if (found) {
+            nodes.setChildTags(n, i, nodes.getChildTags(n, i) | bits);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Fills nearestHits with the k objects nearest to a point that subscribe
+ * to a given tag, nearest first, by visiting nodes in order of their
+ * distance from the point.
+ *
+ * @param point The point to search from.
+ * @param k The number of objects to find.
+ * @param tag The tag of objects to find (-1 for all objects).
+ * @param maxDistance The distance beyond which objects are not found.
+ */
+void RTree::findNearest(const Vec2 point, size_t k, int tag, float maxDistance) {
+    nearestHits.clear();
+    nearestQueue.clear();
+    nearestBound.clear();
+    if (k == 0) {
+        return;
+    }
+    uint64_t tagBit = tag == -1 ? 0 : rtreeTagBit(tag);
+
+    nearestQueue.push_back({0, false, root});
+    while (!nearestQueue.empty()) {
+        std::pop_heap(nearestQueue.begin(), nearestQueue.end());
+        RTreeCandidate next = nearestQueue.back();
+        nearestQueue.pop_back();
+
+        // everything left in the queue is at least as far as this candidate
+        if (next.distance > maxDistance) {
+            break;
+        }
+        if (next.object) {
+            nearestHits.push_back(next.index);
+            if (nearestHits.size() == k) {
+                break;
             }
+            continue;
         }
-    } else {
-        for (auto &child : n.children) {
-            if (child->rect.doesIntersect(center, radius)) {
-                findIntersections(*child, center, radius, tag, res);
+
+        const RTreeNode &node = nodes[next.index];
+        for (size_t i = 0; i < node.count; i++) {
+            if (tagBit != 0 && (nodes.getChildTags(next.index, i) & tagBit) == 0) {
+                continue;
+            }
+
+            RTreeIndex child = nodes.getChild(next.index, i);
+            float distance;
+            if (node.level == 0) {
+                const std::shared_ptr<RTreeObject> &obj = objects[child];
+                if (!hasTag(*obj, tag, tagBit)) {
+                    continue;
+                }
+                distance = RTreeBox(obj->rect).getDistance(point);
+                if (distance > maxDistance) {
+                    continue;
+                }
+
+                // once k objects are queued, nothing farther than the kth can be found
+                if (nearestBound.size() == k) {
+                    std::pop_heap(nearestBound.begin(), nearestBound.end());
+                    nearestBound.back() = std::min(nearestBound.back(), distance);
+                } else {
+                    nearestBound.push_back(distance);
+                }
+                std::push_heap(nearestBound.begin(), nearestBound.end());
+                if (nearestBound.size() == k) {
+                    maxDistance = nearestBound.front();
+                }
+            } else {
+                // objects may have escaped the boxes by up to staleness
+                distance = std::max(nodes.getChildBox(next.index, i).getDistance(point) - staleness, 0.0f);
+            }
+            if (distance <= maxDistance) {
+                nearestQueue.push_back({distance, node.level == 0, child});
+                std::push_heap(nearestQueue.begin(), nearestQueue.end());
             }
         }
     }
 }
 
 /**
- * Given a node to split, selects two children of the original node to become
- * the first children of the two new nodes.
+ * Given the children of a node to split, selects two of them to become the
+ * first children of the two new nodes.
  *
- * @param n The node to split
- * @return Pair of RTreeNode shared pointers containing the first two elements of the two new nodes
+ * @param entries The children of the node to split
+ * @param box The bounding box of the node to split
+ * @return The positions in entries of the first children of the two new nodes
  */
-std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> RTree::pickSeeds(RTreeNode &n) {
+std::pair<size_t, size_t> RTree::pickSeeds(const std::vector<RTreeEntry> &entries, const RTreeBox &box) {
     // Along the x/y dimensions, find the entry with the highest low side, and the entry with the lowest high side
-    std::shared_ptr<RTreeNode> maxLowSideEntryX = nullptr;
-    std::shared_ptr<RTreeNode> minHighSideEntryX = nullptr;
-    std::shared_ptr<RTreeNode> maxLowSideEntryY = nullptr;
-    std::shared_ptr<RTreeNode> minHighSideEntryY = nullptr;
+    const size_t none = entries.size();
+    size_t maxLowSideEntryX = none;
+    size_t minHighSideEntryX = none;
+    size_t maxLowSideEntryY = none;
+    size_t minHighSideEntryY = none;
 
-    for (auto it = n.children.begin(); it != n.children.end(); ++it) {
-        std::shared_ptr<RTreeNode> child = *it;
-        if ((maxLowSideEntryX == nullptr ||
-                 child->rect.getMinX() > maxLowSideEntryX->rect.getMinX()) &&
-                child != minHighSideEntryX) {
-            maxLowSideEntryX = child;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if ((maxLowSideEntryX == none ||
+                 entries[i].box.minX > entries[maxLowSideEntryX].box.minX) &&
+                i != minHighSideEntryX) {
+            maxLowSideEntryX = i;
         }
     }
 
-    for (auto it = n.children.begin(); it != n.children.end(); ++it) {
-        std::shared_ptr<RTreeNode> child = *it;
-        if ((minHighSideEntryX == nullptr ||
-                 child->rect.getMaxX() < minHighSideEntryX->rect.getMaxX()) &&
-                child != maxLowSideEntryX) {
-            minHighSideEntryX = child;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if ((minHighSideEntryX == none ||
+                 entries[i].box.maxX < entries[minHighSideEntryX].box.maxX) &&
+                i != maxLowSideEntryX) {
+            minHighSideEntryX = i;
         }
     }
 
-    for (auto it = n.children.begin(); it != n.children.end(); ++it) {
-        std::shared_ptr<RTreeNode> child = *it;
-        if ((maxLowSideEntryY == nullptr ||
-                 child->rect.getMinY() > maxLowSideEntryY->rect.getMinY()) &&
-                child != minHighSideEntryY) {
-            maxLowSideEntryY = child;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if ((maxLowSideEntryY == none ||
+                 entries[i].box.minY > entries[maxLowSideEntryY].box.minY) &&
+                i != minHighSideEntryY) {
+            maxLowSideEntryY = i;
         }
     }
 
-    for (auto it = n.children.begin(); it != n.children.end(); ++it) {
-        std::shared_ptr<RTreeNode> child = *it;
-        if ((minHighSideEntryY == nullptr ||
-                 child->rect.getMaxY() < minHighSideEntryY->rect.getMaxY()) &&
-                child != maxLowSideEntryY) {
-            minHighSideEntryY = child;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if ((minHighSideEntryY == none ||
+                 entries[i].box.maxY < entries[minHighSideEntryY].box.maxY) &&
+                i != maxLowSideEntryY) {
+            minHighSideEntryY = i;
         }
     }
 
     // Determine the separation between the two sides and normalize them
     double separationX =
-        (double)(minHighSideEntryX->rect.getMaxX() - maxLowSideEntryX->rect.getMinX()) /
-                                                (n.rect.getMaxX() - n.rect.getMinX());
+        (double)(entries[minHighSideEntryX].box.maxX - entries[maxLowSideEntryX].box.minX) /
+                                                (box.maxX - box.minX);
     double separationY =
-        (double)(minHighSideEntryY->rect.getMaxY() - maxLowSideEntryY->rect.getMinY()) /
-                                                (n.rect.getMaxY() - n.rect.getMinY());
+        (double)(entries[minHighSideEntryY].box.maxY - entries[maxLowSideEntryY].box.minY) /
+                                                (box.maxY - box.minY);
 
-    std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> seeds;
     if (separationY > separationX) {
-        seeds.first = maxLowSideEntryY;
-        seeds.second = minHighSideEntryY;
-    } else {
-        seeds.first = maxLowSideEntryX;
-        seeds.second = minHighSideEntryX;
+        return std::make_pair(maxLowSideEntryY, minHighSideEntryY);
     }
-
-    return seeds;
+    return std::make_pair(maxLowSideEntryX, minHighSideEntryX);
 }
 
 /**
  * Selects one remaining child of the node to be split to be added to a newly
  * split node.
  *
- * @param children Vector of children of the node to be split
- * @param added Set of children already assigned to a new node
+ * @param entries The children of the node to be split
+ * @param added Which children are already assigned to a new node
  * @param bbox_1 The bounding box of the first new node
  * @param bbox_2 The bounding box of the second new node
- * @return The next child to be added to a new node
+ * @return The position in entries of the next child to be added to a new node
  */
-std::shared_ptr<RTreeNode> RTree::pickNext(
-        const std::vector<std::shared_ptr<RTreeNode>> &children,
-        const std::unordered_set<std::shared_ptr<RTreeNode>> &added,
-        const Rect &bbox_1, const Rect &bbox_2) {
+size_t RTree::pickNext(const std::vector<RTreeEntry> &entries, const std::vector<bool> &added,
+                       const RTreeBox &bbox_1, const RTreeBox &bbox_2) {
     int max_diff = 0;
-    std::shared_ptr<RTreeNode> max_child = nullptr;
-    
+    size_t max_child = entries.size();
+
     // Find the entry with the maximum area difference between putting it in group 1 and group 2.
-    for (auto it = children.begin(); it != children.end(); ++it) {
-        std::shared_ptr<RTreeNode> child = *it;
-        if (added.find(child) != added.end()) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (added[i]) {
             continue;
         }
 
-        Rect enlarged1 = bbox_1.getMerge(child->rect);
-        Rect enlarged2 = bbox_2.getMerge(child->rect);
-        float area1 = enlarged1.size.width * enlarged1.size.height;
-        float area2 = enlarged2.size.width * enlarged2.size.height;
+        float area1 = bbox_1.getMerge(entries[i].box).getArea();
+        float area2 = bbox_2.getMerge(entries[i].box).getArea();
         float diff = std::abs(area1 - area2);
 
-        if (max_child == nullptr || diff > max_diff) {
-            max_child = child;
+        if (max_child == entries.size() || diff > max_diff) {
+            max_child = i;
             max_diff = diff;
         }
     }
@@ -181,71 +316,297 @@ std::shared_ptr<RTreeNode> RTree::pickNext(
 }
 
 /**
- * Splits an overflowing node into two nodes.
+ * Splits an overflowing node into two nodes. The node keeps the children of
+ * the first node, and a new node receives the rest.
  *
  * @param n The node to be split.
+ * @param box The bounding box of the node to be split.
  * @return The two resulting nodes from the split.
  */
-std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> RTree::linearSplit(RTreeNode &n) {
-    std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> seeds =
-            pickSeeds(n);
-
-    std::shared_ptr<RTreeNode> c1 = seeds.first;
-    std::shared_ptr<RTreeNode> c2 = seeds.second;
-
-    std::unordered_set<std::shared_ptr<RTreeNode>> added;
-    std::shared_ptr<RTreeNode> node1 = std::make_shared<RTreeNode>(
-            c1->rect, std::vector<std::shared_ptr<RTreeNode>>{}, n.level);
-    std::shared_ptr<RTreeNode> node2 = std::make_shared<RTreeNode>(
-            c2->rect, std::vector<std::shared_ptr<RTreeNode>>{}, n.level);
-
-    node1->children.push_back(c1);
-    node2->children.push_back(c2);
-    added.insert(c2);
-    added.insert(c1);
-    while (added.size() < n.children.size()) {
-        std::shared_ptr<RTreeNode> nextNode =
-                pickNext(n.children, added, node1->rect, node2->rect);
-
-        added.insert(nextNode);
-        Rect enlarged1 = node1->rect.getMerge(nextNode->rect);
-        Rect enlarged2 = node2->rect.getMerge(nextNode->rect);
-        float area1 = enlarged1.size.width * enlarged1.size.height;
-        float area2 = enlarged2.size.width * enlarged2.size.height;
-        if (area1 < area2) {
-            node1->children.push_back(nextNode);
-            node1->rect = Rect(enlarged1);
+std::pair<RTreeIndex, RTreeIndex> RTree::linearSplit(RTreeIndex n, const RTreeBox &box) {
+    loadSplitEntries(n);
+    splitAdded.assign(splitEntries.size(), false);
+
+    std::pair<size_t, size_t> seeds = pickSeeds(splitEntries, box);
+    const RTreeEntry &c1 = splitEntries[seeds.first];
+    const RTreeEntry &c2 = splitEntries[seeds.second];
+
+    RTreeIndex node1 = n;
+    RTreeIndex node2 = nodes.acquire(nodes[n].level);
+    nodes.clearChildren(node1);
+
+    RTreeBox bbox1 = c1.box;
+    RTreeBox bbox2 = c2.box;
+    addChild(node1, c1.index, c1.box);
+    addChild(node2, c2.index, c2.box);
+    splitAdded[seeds.first] = true;
+    splitAdded[seeds.second] = true;
+    for (size_t added = 2; added < splitEntries.size(); added++) {
+        size_t next = pickNext(splitEntries, splitAdded, bbox1, bbox2);
+        const RTreeEntry &nextEntry = splitEntries[next];
+
+        splitAdded[next] = true;
+        RTreeBox enlarged1 = bbox1.getMerge(nextEntry.box);
+        RTreeBox enlarged2 = bbox2.getMerge(nextEntry.box);
+        if (enlarged1.getArea() < enlarged2.getArea()) {
+            addChild(node1, nextEntry.index, nextEntry.box);
+            bbox1 = enlarged1;
         } else {
-            node2->children.push_back(nextNode);
-            node2->rect = Rect(enlarged2);
+            addChild(node2, nextEntry.index, nextEntry.box);
+            bbox2 = enlarged2;
         }
     }
     return std::make_pair(node1, node2);
 }
 
 /**
- * Given a rectangle, determine the child bounding box such that the union of the new rectangle and
+ * Copies the children of a node into splitEntries.
+ *
+ * @param n The node to be split.
+ */
+void RTree::loadSplitEntries(RTreeIndex n) {
+    splitEntries.clear();
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        splitEntries.push_back({nodes.getChildBox(n, i), nodes.getChild(n, i)});
+    }
+}
+
+/**
+ * Returns the smallest number of children of the nodes created by a split
+ * of splitEntries.
+ */
+size_t RTree::splitMinimum() const {
+    size_t m = std::min<size_t>(minPerLevel, splitEntries.size() / 2);
+    return std::max<size_t>(m, 1);
+}
+
+/**
+ * Moves the entries of splitSecond to a new node, keeping the others in
+ * the node being split.
+ *
+ * @param n The node to be split.
+ * @return The two resulting nodes from the split.
+ */
+std::pair<RTreeIndex, RTreeIndex> RTree::distributeSplit(RTreeIndex n) {
+    RTreeIndex node2 = nodes.acquire(nodes[n].level);
+    nodes.clearChildren(n);
+    for (size_t i = 0; i < splitEntries.size(); i++) {
+        addChild(splitSecond[i] ? node2 : n, splitEntries[i].index, splitEntries[i].box);
+    }
+    return std::make_pair(n, node2);
+}
+
+/**
+ * Splits an overflowing node into two nodes with Guttman's quadratic split.
+ *
+ * @param n The node to be split.
+ * @return The two resulting nodes from the split.
+ */
+std::pair<RTreeIndex, RTreeIndex> RTree::quadraticSplit(RTreeIndex n) {
+    loadSplitEntries(n);
+    size_t count = splitEntries.size();
+    size_t minimum = splitMinimum();
+    splitAdded.assign(count, false);
+    splitSecond.assign(count, false);
+
+    // Seed the nodes with the pair that would waste the most area together
+    size_t seed1 = 0;
+    size_t seed2 = 1;
+    float maxWaste = -INFINITY;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            const RTreeBox &a = splitEntries[i].box;
+            const RTreeBox &b = splitEntries[j].box;
+            float waste = a.getMerge(b).getArea() - a.getArea() - b.getArea();
+            if (waste > maxWaste) {
+                maxWaste = waste;
+                seed1 = i;
+                seed2 = j;
+            }
+        }
+    }
+
+    RTreeBox bbox1 = splitEntries[seed1].box;
+    RTreeBox bbox2 = splitEntries[seed2].box;
+    size_t count1 = 1;
+    size_t count2 = 1;
+    splitAdded[seed1] = true;
+    splitAdded[seed2] = true;
+    splitSecond[seed2] = true;
+    for (size_t remaining = count - 2; remaining > 0; remaining--) {
+        // Give the rest to a node that needs all of them to reach the minimum
+        if (count1 + remaining <= minimum || count2 + remaining <= minimum) {
+            bool second = count2 + remaining <= minimum;
+            for (size_t i = 0; i < count; i++) {
+                if (!splitAdded[i]) {
+                    splitAdded[i] = true;
+                    splitSecond[i] = second;
+                }
+            }
+            break;
+        }
+
+        // Pick the entry with the strongest preference for one of the nodes
+        size_t next = count;
+        float maxDiff = -1;
+        float next1 = 0;
+        float next2 = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!splitAdded[i]) {
+                float d1 = bbox1.getMerge(splitEntries[i].box).getArea() - bbox1.getArea();
+                float d2 = bbox2.getMerge(splitEntries[i].box).getArea() - bbox2.getArea();
+                if (std::abs(d1 - d2) > maxDiff) {
+                    maxDiff = std::abs(d1 - d2);
+                    next = i;
+                    next1 = d1;
+                    next2 = d2;
+                }
+            }
+        }
+
+        bool second = next2 < next1;
+        if (next1 == next2) {
+            float area1 = bbox1.getArea();
+            float area2 = bbox2.getArea();
+            second = area2 < area1 || (area1 == area2 && count2 < count1);
+        }
+        splitAdded[next] = true;
+        splitSecond[next] = second;
+        if (second) {
+            bbox2 += splitEntries[next].box;
+            count2++;
+        } else {
+            bbox1 += splitEntries[next].box;
+            count1++;
+        }
+    }
+    return distributeSplit(n);
+}
+
+/**
+ * Splits an overflowing node into two nodes with the R*-tree split, which
+ * picks the axis with the smallest margins, and then the distribution
+ * along it with the least overlap.
+ *
+ * @param n The node to be split.
+ * @return The two resulting nodes from the split.
+ */
+std::pair<RTreeIndex, RTreeIndex> RTree::rstarSplit(RTreeIndex n) {
+    loadSplitEntries(n);
+    size_t count = splitEntries.size();
+    size_t minimum = splitMinimum();
+    splitOrder.resize(count);
+    splitPrefix.resize(count);
+    splitSuffix.resize(count);
+
+    // Sorts splitOrder by the lower or upper bounds along an axis, and fills
+    // the boxes of its prefixes and suffixes
+    auto sortAlong = [this, count](bool yAxis, bool upper) {
+        auto key = [this, yAxis, upper](size_t i) {
+            const RTreeBox &b = splitEntries[i].box;
+            float lo = yAxis ? b.minY : b.minX;
+            float hi = yAxis ? b.maxY : b.maxX;
+            return upper ? std::make_pair(hi, lo) : std::make_pair(lo, hi);
+        };
+        for (size_t i = 0; i < count; i++) {
+            splitOrder[i] = i;
+        }
+        std::sort(splitOrder.begin(), splitOrder.end(), [&key](size_t a, size_t b) {
+            std::pair<float, float> ka = key(a);
+            std::pair<float, float> kb = key(b);
+            return ka < kb || (ka == kb && a < b);
+        });
+        splitPrefix[0] = splitEntries[splitOrder[0]].box;
+        for (size_t i = 1; i < count; i++) {
+            splitPrefix[i] = splitPrefix[i - 1].getMerge(splitEntries[splitOrder[i]].box);
+        }
+        splitSuffix[count - 1] = splitEntries[splitOrder[count - 1]].box;
+        for (size_t i = count - 1; i > 0; i--) {
+            splitSuffix[i - 1] = splitSuffix[i].getMerge(splitEntries[splitOrder[i - 1]].box);
+        }
+    };
+
+    // Choose the axis whose distributions have the smallest total margin
+    bool yAxis = false;
+    float minMargin = INFINITY;
+    for (int axis = 0; axis < 2; axis++) {
+        float margin = 0;
+        for (int upper = 0; upper < 2; upper++) {
+            sortAlong(axis == 1, upper == 1);
+            for (size_t k = minimum; k <= count - minimum; k++) {
+                margin += splitPrefix[k - 1].getMargin() + splitSuffix[k].getMargin();
+            }
+        }
+        if (margin < minMargin) {
+            minMargin = margin;
+            yAxis = axis == 1;
+        }
+    }
+
+    // Choose the distribution along it with the least overlap, then least area
+    bool bestUpper = false;
+    size_t bestSplit = minimum;
+    float minOverlap = INFINITY;
+    float minArea = INFINITY;
+    for (int upper = 0; upper < 2; upper++) {
+        sortAlong(yAxis, upper == 1);
+        for (size_t k = minimum; k <= count - minimum; k++) {
+            float overlap = splitPrefix[k - 1].getOverlap(splitSuffix[k]);
+            float area = splitPrefix[k - 1].getArea() + splitSuffix[k].getArea();
+            if (overlap < minOverlap || (overlap == minOverlap && area < minArea)) {
+                minOverlap = overlap;
+                minArea = area;
+                bestUpper = upper == 1;
+                bestSplit = k;
+            }
+        }
+    }
+
+    sortAlong(yAxis, bestUpper);
+    splitSecond.assign(count, false);
+    for (size_t k = bestSplit; k < count; k++) {
+        splitSecond[splitOrder[k]] = true;
+    }
+    return distributeSplit(n);
+}
+
+/**
+ * Splits an overflowing node into two nodes with the algorithm of this RTree.
+ *
+ * @param n The node to be split.
+ * @param box The bounding box of the node to be split.
+ * @return The two resulting nodes from the split.
+ */
+std::pair<RTreeIndex, RTreeIndex> RTree::splitNode(RTreeIndex n, const RTreeBox &box) {
+    switch (split) {
+        case RTreeSplit::QUADRATIC:
+            return quadraticSplit(n);
+        case RTreeSplit::RSTAR:
+            return rstarSplit(n);
+        default:
+            return linearSplit(n, box);
+    }
+}
+
+/**
+ * Given a box, determine the child bounding box such that the union of the new box and
  * child bounding box is minimal.
  *
  * @param n The parent of the candidate child nodes to be checked.
- * @param containerRect The bounding box of the object to be inserted
- * @return The node that can expand to fit containerRect with minimal area increase.
+ * @param containerBox The bounding box of the object to be inserted
+ * @return The position of the child that can expand to fit containerBox with minimal area increase.
  */
-std::shared_ptr<RTreeNode> RTree::findBestBB(RTreeNode &n, const Rect &containerRect) {
+size_t RTree::findBestBB(RTreeIndex n, const RTreeBox &containerBox) {
     float minAreaIncrease = INT32_MAX;
-    Rect best_bb = Rect(-1, -1, -1, -1);
-    std::shared_ptr<RTreeNode> bestChild = nullptr;
+    size_t bestChild = 0;
 
-    for (auto &child : n.children) {
-        Rect r = child->rect;
-        Rect enlargedBB = r.getMerge(containerRect);
-        float areaEnlarged = enlargedBB.size.width * enlargedBB.size.height;
-        float areaChild = r.size.width * r.size.height;
-        float areaIncrease = areaEnlarged - areaChild;
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        RTreeBox r = nodes.getChildBox(n, i);
+        float areaIncrease = r.getMerge(containerBox).getArea() - r.getArea();
 
         if (areaIncrease < minAreaIncrease) {
             minAreaIncrease = areaIncrease;
-            bestChild = child;
+            bestChild = i;
         }
     }
 
@@ -253,190 +614,602 @@ std::shared_ptr<RTreeNode> RTree::findBestBB(RTreeNode &n, const Rect &container
 }
 
 /**
- * Inserts an object into a node.
+ * Chooses the child of a node to insert a box into, with the algorithm
+ * of this RTree.
  *
- * @param n The node into which the object will be inserted.
- * @param obj The object to insert.
+ * @param n The node into which the box will be inserted.
+ * @param containerBox The box to insert.
+ * @return The position of the chosen child.
  */
-void RTree::insertHelper(RTreeNode &n, std::shared_ptr<RTreeObject> &obj) {
-    Rect containerRect =
-            Rect(obj->rect.getMinX() - bufferSize, obj->rect.getMinY() - bufferSize,
-                     obj->rect.size.width + bufferSize * 2,
-                     obj->rect.size.height + bufferSize * 2);
-
-    if (n.level > 0) {
-        std::shared_ptr<RTreeNode> bestChild = nullptr;
-        bool fitsInChild = false;
-        for (auto it = n.children.begin(); it != n.children.end(); ++it) {
-            Rect r = (*it)->rect;
-            if (r.contains(containerRect)) {
-                insertHelper(*(*it), obj);
-                fitsInChild = true;
-                bestChild = (*it);
-                break;
+size_t RTree::chooseSubtree(RTreeIndex n, const RTreeBox &containerBox) {
+    size_t count = nodes[n].count;
+    if (split == RTreeSplit::LINEAR) {
+        for (size_t i = 0; i < count; i++) {
+            if (nodes.getChildBox(n, i).contains(containerBox)) {
+                return i;
             }
         }
 
         // If no child node can fit this object, expand one of them to fit it
-        if (!fitsInChild) {
-            bestChild = findBestBB(n, containerRect);
-            bestChild->rect += containerRect;
-            insertHelper(*bestChild, obj);
-        }
-        if ((*bestChild).children.size() > maxPerLevel) {
-            std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> nodes =
-                    linearSplit(*bestChild);
-            n.deleteChild(*bestChild);
-            n.addChild(nodes.first);
-            n.addChild(nodes.second);
+        return findBestBB(n, containerBox);
+    }
+
+    // The R*-tree minimizes the growth of overlap among the nodes that hold
+    // objects, and of area everywhere else, like the quadratic R-tree
+    bool byOverlap = split == RTreeSplit::RSTAR && nodes[n].level == 1;
+    size_t bestChild = 0;
+    float bestOverlap = 0;
+    float bestIncrease = 0;
+    float bestArea = 0;
+    for (size_t i = 0; i < count; i++) {
+        RTreeBox r = nodes.getChildBox(n, i);
+        RTreeBox enlarged = r.getMerge(containerBox);
+        float overlapIncrease = 0;
+        if (byOverlap) {
+            for (size_t j = 0; j < count; j++) {
+                if (j != i) {
+                    RTreeBox other = nodes.getChildBox(n, j);
+                    overlapIncrease += enlarged.getOverlap(other) - r.getOverlap(other);
+                }
+            }
+        }
+        float area = r.getArea();
+        float areaIncrease = enlarged.getArea() - area;
+        if (i == 0 || overlapIncrease < bestOverlap ||
+            (overlapIncrease == bestOverlap &&
+             (areaIncrease < bestIncrease || (areaIncrease == bestIncrease && area < bestArea)))) {
+            bestChild = i;
+            bestOverlap = overlapIncrease;
+            bestIncrease = areaIncrease;
+            bestArea = area;
+        }
+    }
+    return bestChild;
+}
+
+/**
+ * Removes the children of a child of a node that are farthest from its
+ * center, and queues them in reinserts, as the R*-tree does with the
+ * first node that overflows at each level of an insertion.
+ *
+ * @param n The parent of the overflowing node.
+ * @param i The position of the overflowing node in its parent.
+ */
+void RTree::forceReinsert(RTreeIndex n, size_t i) {
+    RTreeIndex child = nodes.getChild(n, i);
+    loadSplitEntries(child);
+    RTreeBox box = nodes.getChildBox(n, i);
+    float x = box.getMidX();
+    float y = box.getMidY();
+    auto distance = [x, y](const RTreeEntry &e) {
+        float dx = e.box.getMidX() - x;
+        float dy = e.box.getMidY() - y;
+        return dx * dx + dy * dy;
+    };
+    std::stable_sort(splitEntries.begin(), splitEntries.end(),
+                     [&distance](const RTreeEntry &a, const RTreeEntry &b) {
+                         return distance(a) < distance(b);
+                     });
+
+    // Reinsert 30% of the entries, keeping enough for the node not to underflow
+    size_t keep = splitEntries.size() - std::max<size_t>(1, splitEntries.size() * 3 / 10);
+    keep = std::max<size_t>(keep, splitMinimum());
+    nodes.clearChildren(child);
+    for (size_t j = 0; j < keep; j++) {
+        addChild(child, splitEntries[j].index, splitEntries[j].box);
+    }
+    nodes.setChildBox(n, i, nodes.getBounds(child));
+    nodes.setChildTags(n, i, nodes.getTags(child));
+
+    // Queue the farthest first, so that the closest is reinserted first
+    for (size_t j = splitEntries.size(); j > keep; j--) {
+        reinserts.emplace_back(splitEntries[j - 1], nodes[child].level);
+    }
+}
+
+/**
+ * Inserts an entry into a node.
+ *
+ * @param n The node into which the entry will be inserted.
+ * @param entry The index of the object or node to insert.
+ * @param containerBox The bounding box of the entry.
+ * @param tags The tag mask of the entry.
+ * @param level The level of the node that receives the entry; 0 for objects.
+ */
+void RTree::insertHelper(RTreeIndex n, RTreeIndex entry, const RTreeBox &containerBox, uint64_t tags,
+                         int level) {
+    if (nodes[n].level > level) {
+        size_t bestChild = chooseSubtree(n, containerBox);
+        nodes.setChildBox(n, bestChild, nodes.getChildBox(n, bestChild).getMerge(containerBox));
+        nodes.setChildTags(n, bestChild, nodes.getChildTags(n, bestChild) | tags);
+
+        RTreeIndex child = nodes.getChild(n, bestChild);
+        insertHelper(child, entry, containerBox, tags, level);
+        if (nodes[child].count > maxPerLevel) {
+            uint64_t levelBit = (uint64_t)1 << (nodes[child].level & 63);
+            if (split == RTreeSplit::RSTAR && !(reinsertedLevels & levelBit)) {
+                reinsertedLevels |= levelBit;
+                forceReinsert(n, bestChild);
+                return;
+            }
+            std::pair<RTreeIndex, RTreeIndex> halves =
+                    splitNode(child, nodes.getChildBox(n, bestChild));
+            nodes.removeChild(n, bestChild);
+            addChild(n, halves.first, nodes.getBounds(halves.first));
+            addChild(n, halves.second, nodes.getBounds(halves.second));
+        }
+    } else {
+        nodes.addChild(n, entry, containerBox, tags);
+    }
+}
+
+/**
+ * Inserts an entry into the tree at the given level, splitting the root
+ * if it overflows.
+ *
+ * @param entry The index of the object or node to insert.
+ * @param containerBox The bounding box of the entry.
+ * @param level The level of the node that receives the entry; 0 for objects.
+ */
+void RTree::insertAtLevel(RTreeIndex entry, const RTreeBox &containerBox, int level) {
+    uint64_t tags = level == 0 ? getObjectTags(entry) : nodes.getTags(entry);
+    insertHelper(root, entry, containerBox, tags, level);
+    if (nodes[root].count > maxPerLevel) {
+        RTreeIndex newRoot = nodes.acquire(nodes[root].level + 1);
+        std::pair<RTreeIndex, RTreeIndex> halves = splitNode(root, RTreeBox(rect));
+        addChild(newRoot, halves.first, nodes.getBounds(halves.first));
+        addChild(newRoot, halves.second, nodes.getBounds(halves.second));
+        root = newRoot;
+    }
+}
+
+/**
+ * Inserts an object into the tree, splitting the root if it overflows.
+ *
+ * @param obj The index of the object to insert.
+ * @param containerBox The bounding box of the object.
+ */
+void RTree::insertEntry(RTreeIndex obj, const RTreeBox &containerBox) {
+    reinsertedLevels = 0;
+    insertAtLevel(obj, containerBox, 0);
+    while (!reinserts.empty()) {
+        std::pair<RTreeEntry, int> next = reinserts.back();
+        reinserts.pop_back();
+        insertAtLevel(next.first.index, next.first.box, next.second);
+    }
+}
+
+/**
+ * Returns the slot of an object in the bounds table, or RTREE_NONE if it
+ * is not in this RTree.
+ *
+ * @param obj The object.
+ */
+RTreeIndex RTree::findObject(const RTreeObject *obj) const {
+    for (const std::pair<RTree*, uint32_t> &slot : obj->slots) {
+        if (slot.first == this) {
+            return slot.second;
+        }
+    }
+    return RTREE_NONE;
+}
+
+/**
+ * Stores an object and its padded bounding box in the bounds table,
+ * reusing the slot of a removed object if there is one.
+ *
+ * @param obj The object to store.
+ * @return The slot of the object.
+ */
+RTreeIndex RTree::addObject(const std::shared_ptr<RTreeObject> &obj) {
+    RTreeIndex slot;
+    // objects added during a background reconstruction go after its snapshot
+    if (freeObjects.empty() || building) {
+        slot = (RTreeIndex)objects.size();
+        objects.push_back(obj);
+        boxes.emplace_back();
+        positions.emplace_back();
+        speeds.push_back(0);
+    } else {
+        slot = freeObjects.back();
+        freeObjects.pop_back();
+        objects[slot] = obj;
+    }
+    // until an object has moved, it is padded as if by bufferSize
+    positions[slot] = obj->rect.origin;
+    speeds[slot] = bufferSize / paddingUpdates;
+    boxes[slot] = getContainer(slot);
+    obj->slots.emplace_back(this, slot);
+    objectCount++;
+    return slot;
+}
+
+/**
+ * Removes an object from the bounds table. Its slot is reused once no
+ * tree contains it anymore.
+ *
+ * @param slot The slot of the object.
+ */
+void RTree::releaseObject(RTreeIndex slot) {
+    std::vector<std::pair<RTree*, uint32_t>> &slots = objects[slot]->slots;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].first == this) {
+            slots[i] = slots.back();
+            slots.pop_back();
+            break;
         }
+    }
+    objects[slot] = nullptr;
+    objectCount--;
+
+    // the tree being built in the background may still contain the slot
+    if (building) {
+        freedDuringBuild.push_back(slot);
     } else {
-        std::vector<std::shared_ptr<RTreeNode>> emptyVector;
-        std::shared_ptr<RTreeNode> containerNode =
-                std::make_shared<RTreeNode>(containerRect, emptyVector, -1);
-        containerNode->obj = obj;
-        n.children.push_back(containerNode);
-        objectToBBox.insert(std::make_pair(obj, containerRect));
+        freeObjects.push_back(slot);
+    }
+}
+
+/**
+ * Removes every object from the bounds table.
+ */
+void RTree::releaseObjects() {
+    for (RTreeIndex slot = 0; slot < objects.size(); slot++) {
+        if (objects[slot] != nullptr) {
+            releaseObject(slot);
+        }
+    }
+    objects.clear();
+    boxes.clear();
+    positions.clear();
+    speeds.clear();
+    freeObjects.clear();
+    freedDuringBuild.clear();
+}
+
+/**
+ * Removes an object from the tree, reinserting the objects of any node
+ * that underflows and shrinking the root if it is left with one child.
+ *
+ * @param obj The slot of the object to remove.
+ * @param containerBox The bounding box of the object.
+ */
+void RTree::removeEntry(RTreeIndex obj, const RTreeBox &containerBox) {
+    orphans.clear();
+    removeHelper(root, obj, containerBox);
+    for (RTreeIndex orphan : orphans) {
+        // objects removed while a background reconstruction was running are
+        // removed from its tree after it completes
+        if (objects[orphan] != nullptr) {
+            insertEntry(orphan, boxes[orphan]);
+        }
+    }
+
+    while (nodes[root].level > 0 && nodes[root].count == 1) {
+        RTreeIndex oldRoot = root;
+        root = nodes.getChild(oldRoot, 0);
+        nodes.release(oldRoot);
     }
 }
 
 /**
  * Searches for an object in a given node, and if it is found, removes it.
  *
- * If removing the object causes the node to have too few children, the
- * remaining children are removed and returned.
+ * If removing the object causes a child to have too few children, that child
+ * is removed, and the objects below it are added to orphans to be reinserted.
  *
  * @param n The node to search.
- * @param obj The object to be removed.
- * @return A list of objects to reinsert into the tree.
- */
-std::vector<std::shared_ptr<RTreeObject>> RTree::removeHelper(
-        std::shared_ptr<RTreeNode> &n, std::shared_ptr<RTreeObject> &obj) {
-    std::vector<std::shared_ptr<RTreeObject>> entriesToReinsert;
-
-    if (n->level == 0) {
-        bool removed = false;
-        for (auto it = n->children.begin(); it != n->children.end(); ++it) {
-            if ((*it)->obj.get() == obj.get()) {
-                n->children.erase(it);
-                removed = true;
-                break;
-            }
-        }
-        
-        if (removed && n->children.size() < minPerLevel) {
-            for (auto it = n->children.begin(); it != n->children.end(); ++it) {
-                entriesToReinsert.push_back((*it)->obj);
+ * @param obj The slot of the object to be removed.
+ * @param containerBox The bounding box of the object.
+ * @return true if the object was found and removed.
+ */
+bool RTree::removeHelper(RTreeIndex n, RTreeIndex obj, const RTreeBox &containerBox) {
+    if (nodes[n].level == 0) {
+        for (size_t i = 0; i < nodes[n].count; i++) {
+            if (nodes.getChild(n, i) == obj) {
+                nodes.removeChild(n, i);
+                return true;
             }
-            n->children.clear();
         }
+        return false;
     }
 
-    else {
-        bool mustResize = false;
-        auto it = n->children.begin();
-        while (it != n->children.end()) {
-            auto entries = removeHelper((*it), obj);
-            if (entries.size() > 0) {
-                entriesToReinsert = entries;
-
-                // Erase the current child from the vector and obtain the iterator to
-                // the next element
-                mustResize = true;
-                break;
+    // the bounding box of every ancestor of the object contains its bounding box
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        if (!nodes.getChildBox(n, i).contains(containerBox)) {
+            continue;
+        }
+        RTreeIndex child = nodes.getChild(n, i);
+        if (removeHelper(child, obj, containerBox)) {
+            if (nodes[child].count < minPerLevel) {
+                nodes.removeChild(n, i);
+                collectOrphans(child);
             } else {
-                ++it;
+                nodes.setChildBox(n, i, nodes.getBounds(child));
+                nodes.setChildTags(n, i, nodes.getTags(child));
             }
+            return true;
         }
+    }
+    return false;
+}
 
-        if (mustResize && n->level != root->level) {
-            Rect newBBox = n->children[0]->rect;
-            for (auto it = n->children.begin(); it != n->children.end(); ++it) {
-                newBBox += (*it)->rect;
-            }
-            n->rect = newBBox;
+/**
+ * Releases the nodes of a subtree, adding the objects below it to orphans.
+ *
+ * @param n The root of the subtree.
+ */
+void RTree::collectOrphans(RTreeIndex n) {
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        if (nodes[n].level == 0) {
+            orphans.push_back(nodes.getChild(n, i));
+        } else {
+            collectOrphans(nodes.getChild(n, i));
         }
     }
+    nodes.release(n);
+}
 
-    return entriesToReinsert;
+/** The smallest number of entries that each thread of a parallel STR build gets. */
+static const size_t STR_MIN_ENTRIES_PER_THREAD = 16384;
+
+/**
+ * Orders entries by the x-coordinates of their centers. Ties are broken by
+ * index, so that every sort produces the same order.
+ */
+static bool compareMidX(const RTreeEntry &a, const RTreeEntry &b) {
+    float ax = a.box.getMidX();
+    float bx = b.box.getMidX();
+    return ax < bx || (ax == bx && a.index < b.index);
+}
+
+/**
+ * Orders entries by the y-coordinates of their centers. Ties are broken by
+ * index, so that every sort produces the same order.
+ */
+static bool compareMidY(const RTreeEntry &a, const RTreeEntry &b) {
+    float ay = a.box.getMidY();
+    float by = b.box.getMidY();
+    return ay < by || (ay == by && a.index < b.index);
 }
 
 /**
- * Partition a list of child nodes into a certain amount of new parent nodes.
+ * Calls f(first, last) for consecutive ranges that split [0, count) into
+ * the given number of parts, each on its own thread. The last part runs on
+ * the calling thread.
  *
- * @param nodes Vector of nodes to be partitioned
- * @return Vector of the new children nodes
+ * @param count The size of the range to split.
+ * @param threads The number of parts.
+ * @param f The function to call for each part.
  */
-std::vector<std::shared_ptr<RTreeNode>> RTree::strSplit(
-        std::vector<std::shared_ptr<RTreeNode>> &nodes, int level) {
-    std::vector<std::shared_ptr<RTreeNode>> parents;
-    std::sort(nodes.begin(), nodes.end(),
-                        [](const std::shared_ptr<RTreeNode> &a,
-                             const std::shared_ptr<RTreeNode> &b) {
-                            return a->rect.getMidX() < b->rect.getMidX();
-                        });
+template <typename F>
+static void parallelFor(size_t count, size_t threads, const F &f) {
+    threads = std::max<size_t>(std::min(threads, count), 1);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t + 1 < threads; t++) {
+        workers.emplace_back(f, count * t / threads, count * (t + 1) / threads);
+    }
+    f(count * (threads - 1) / threads, count);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
 
-    int numLeafNodes = std::ceil(nodes.size() / (float)maxPerLevel);
+/**
+ * Sorts entries with the given number of threads. Each thread sorts a
+ * chunk, and the chunks are then merged pairwise.
+ *
+ * @param entries The entries to sort.
+ * @param threads The number of threads.
+ * @param compare The strict total order to sort by.
+ */
+static void parallelSort(std::vector<RTreeEntry> &entries, size_t threads,
+                         bool (*compare)(const RTreeEntry &, const RTreeEntry &)) {
+    if (threads <= 1) {
+        std::sort(entries.begin(), entries.end(), compare);
+        return;
+    }
+
+    std::vector<size_t> chunks(threads + 1);
+    for (size_t t = 0; t <= threads; t++) {
+        chunks[t] = entries.size() * t / threads;
+    }
+    auto begin = entries.begin();
+    parallelFor(threads, threads, [&](size_t first, size_t last) {
+        for (size_t c = first; c < last; c++) {
+            std::sort(begin + chunks[c], begin + chunks[c + 1], compare);
+        }
+    });
+    for (size_t width = 1; width < threads; width *= 2) {
+        size_t merges = (threads + 2 * width - 1) / (2 * width);
+        parallelFor(merges, merges, [&](size_t first, size_t last) {
+            for (size_t m = first; m < last; m++) {
+                size_t lo = 2 * width * m;
+                size_t mid = std::min(lo + width, threads);
+                size_t hi = std::min(lo + 2 * width, threads);
+                std::inplace_merge(begin + chunks[lo], begin + chunks[mid], begin + chunks[hi], compare);
+            }
+        });
+    }
+}
+
+/**
+ * Partition a list of entries into a certain amount of new parent nodes.
+ *
+ * The entries are sorted, and the slices packed, with up to the given number
+ * of threads. The result does not depend on the number of threads.
+ *
+ * This only touches its arguments, so it can run on the builder thread.
+ *
+ * @param pool The pool to acquire the new parent nodes from
+ * @param entries Vector of entries to be partitioned
+ * @param parents Vector to fill with the new parent nodes
+ * @param tags The tag masks of the objects, by index
+ * @param level The level of the new parent nodes
+ * @param threads The largest number of threads to use
+ */
+void RTree::strSplit(RTreeNodePool &pool, std::vector<RTreeEntry> &entries,
+                     std::vector<RTreeEntry> &parents, const std::vector<uint64_t> &tags, int level,
+        unsigned threads) const {
+    parents.clear();
+    size_t useThreads = std::max<size_t>(std::min<size_t>(threads, entries.size() / STR_MIN_ENTRIES_PER_THREAD), 1);
+    parallelSort(entries, useThreads, compareMidX);
+
+    int numLeafNodes = std::ceil(entries.size() / (float)maxPerLevel);
     int numSlices = std::ceil(std::sqrt(numLeafNodes));
     int nodesPerSlice = numSlices * maxPerLevel;
 
+    // acquire the parents in the order of a sequential build, so that the
+    // slices can be packed concurrently into nodes that do not depend on the threads
+    std::vector<size_t> sliceParents(numSlices + 1, 0);
     for (int i = 0; i < numSlices; ++i) {
-        std::vector<std::shared_ptr<RTreeNode>> sliceNodes;
-
-        for (int j = i * nodesPerSlice;
-                 j < std::min((i + 1) * nodesPerSlice, (int)nodes.size()); ++j) {
-            sliceNodes.push_back(nodes[j]);
+        int sliceSize = std::max(std::min((i + 1) * nodesPerSlice, (int)entries.size()) - i * nodesPerSlice, 0);
+        int groups = (sliceSize + maxPerLevel - 1) / maxPerLevel;
+        for (int g = 0; g < groups; ++g) {
+            parents.push_back({RTreeBox(), pool.acquire(level)});
         }
+        sliceParents[i + 1] = parents.size();
+    }
 
-        std::sort(sliceNodes.begin(), sliceNodes.end(),
-                            [](const std::shared_ptr<RTreeNode> &a,
-                                 const std::shared_ptr<RTreeNode> &b) {
-                                return a->rect.getMidY() < b->rect.getMidY();
-                            });
+    parallelFor(numSlices, useThreads, [&](size_t firstSlice, size_t lastSlice) {
+        for (size_t i = firstSlice; i < lastSlice; ++i) {
+            auto sliceBegin = entries.begin() + std::min((int)i * nodesPerSlice, (int)entries.size());
+            auto sliceEnd = entries.begin() + std::min(((int)i + 1) * nodesPerSlice, (int)entries.size());
 
-        auto it = sliceNodes.begin();
-        while (it != sliceNodes.end()) {
-            auto end = std::next(it, maxPerLevel);
-            if (std::distance(it, sliceNodes.end()) < maxPerLevel) {
-                end = sliceNodes.end();
+            std::sort(sliceBegin, sliceEnd, compareMidY);
+
+            auto it = sliceBegin;
+            for (size_t p = sliceParents[i]; p < sliceParents[i + 1]; ++p) {
+                auto end = std::distance(it, sliceEnd) < maxPerLevel ? sliceEnd : std::next(it, maxPerLevel);
+                RTreeIndex parent = parents[p].index;
+                for (; it != end; ++it) {
+                    pool.addChild(parent, it->index, it->box,
+                                  level == 0 ? tags[it->index] : pool.getTags(it->index));
+                }
+                parents[p].box = pool.getBounds(parent);
             }
-            std::vector<std::shared_ptr<RTreeNode>> children(it, end);
-            std::shared_ptr<RTreeNode> parent =
-                    std::make_shared<RTreeNode>(children, level);
-            parents.push_back(parent);
-            it = end;
         }
-    }
-
-    return parents;
+    });
 }
 
 /**
- * Build an R-Tree from the bottom up using a list of nodes.
+ * Build an R-Tree from the bottom up using a list of objects.
  *
  * Uses the Sort-Tile-Recursive (STR) algorithm to build an rtree using a bulk
  * insertion. This builds trees faster than inserting objects one-by-one and
  * results in less overlaps between subtrees.
  *
- * Precondition: nodes is non-empty.
+ * This only touches its arguments, so it can run on the builder thread.
  *
- * @param nodes The list of nodes to be bulk inserted into the RTree.
+ * @param pool The pool to acquire the nodes from
+ * @param entries The objects to insert, which are reordered
+ * @param parents Scratch space for the levels above the objects
+ * @param tags The tag masks of the objects, by index
+ * @param threads The largest number of threads to use
  * @return The root node of the new RTree.
  */
-std::shared_ptr<RTreeNode> RTree::sortTileRecursive(
-        std::vector<std::shared_ptr<RTreeNode>> &nodes) {
-    std::vector<std::shared_ptr<RTreeNode>> parents = strSplit(nodes, 0);
+RTreeIndex RTree::sortTileRecursive(RTreeNodePool &pool, std::vector<RTreeEntry> &entries,
+                                    std::vector<RTreeEntry> &parents, const std::vector<uint64_t> &tags,
+        unsigned threads) const {
+    if (entries.empty()) {
+        return pool.acquire(0);
+    }
 
-    int level = 1;
+    int level = 0;
+    strSplit(pool, entries, parents, tags, level, threads);
     while (parents.size() > 1) {
-        parents = strSplit(parents, level);
+        entries.swap(parents);
         level += 1;
+        strSplit(pool, entries, parents, tags, level, threads);
     }
 
-    std::shared_ptr<RTreeNode> newRoot = parents[0];
-    newRoot->rect = root->rect;
+    return parents[0].index;
+}
 
-    return parents[0];
+/**
+ * Snapshots the bounding boxes of the objects and starts building a tree
+ * from them on the builder thread.
+ */
+void RTree::startRebuild() {
+    MSG_TRACE_SCOPE("RTree::startRebuild");
+    backNodes.clear();
+    backBoxes.assign(objects.size(), RTreeBox());
+    backEntries.clear();
+    backTags.assign(objects.size(), 0);
+    tagsAddedDuringBuild = false;
+    for (RTreeIndex i = 0; i < objects.size(); i++) {
+        if (objects[i] != nullptr) {
+            RTreeBox box = getContainer(i);
+            backEntries.push_back({box, i});
+            backBoxes[i] = box;
+            backTags[i] = objects[i]->getTagMask();
+        }
+    }
+
+    building = true;
+    staleUpdates = 0;
+    built = false;
+    unsigned threads = buildThreads;
+    builder = std::thread([this, threads] {
+        backRoot = sortTileRecursive(backNodes, backEntries, backParents, backTags, threads);
+        built = true;
+    });
+}
+
+/**
+ * Waits for the background reconstruction and swaps its tree in. Objects
+ * that were inserted or removed while it was built are added or removed.
+ */
+void RTree::finishRebuild() {
+    MSG_TRACE_SCOPE("RTree::finishRebuild");
+    builder.join();
+    building = false;
+    std::swap(nodes, backNodes);
+    root = backRoot;
+    changed = 0;
+
+    // slots up to the size of the snapshot are in the new tree, with the boxes
+    // of the snapshot, and the ones after it were added since
+    RTreeIndex snapshot = (RTreeIndex)backBoxes.size();
+    for (RTreeIndex i = 0; i < snapshot; i++) {
+        if (objects[i] != nullptr) {
+            boxes[i] = backBoxes[i];
+        }
+    }
+    for (RTreeIndex slot : freedDuringBuild) {
+        if (slot < snapshot) {
+            removeEntry(slot, backBoxes[slot]);
+        }
+        freeObjects.push_back(slot);
+    }
+    freedDuringBuild.clear();
+    for (RTreeIndex i = snapshot; i < objects.size(); i++) {
+        if (objects[i] != nullptr) {
+            boxes[i] = getContainer(i);
+            insertEntry(i, boxes[i]);
+        }
+    }
+
+    // the snapshot has the tag masks from before the build
+    if (tagsAddedDuringBuild) {
+        refreshTags(root);
+    }
+
+    // keep the memory of the previous tree for the next build
+    backNodes.clear();
+}
+
+/**
+ * Waits for the background reconstruction, if any, and throws its tree away.
+ */
+void RTree::cancelRebuild() {
+    if (building) {
+        builder.join();
+        building = false;
+        backNodes.clear();
+        freeObjects.insert(freeObjects.end(), freedDuringBuild.begin(), freedDuringBuild.end());
+        freedDuringBuild.clear();
+    }
 }
 
 /**
@@ -452,26 +1225,108 @@ std::shared_ptr<RTreeNode> RTree::sortTileRecursive(
  * @param maxChildren Maximum number of children per node (default is 5).
  * @param minChildren Minimum number of children per node (default is 2).
  * @param buffer The amount of padding on each side of the bounding box of each object.
+ * @param split The algorithm used to insert objects and split nodes (default is LINEAR).
  */
 RTree::RTree(float x, float y, float width, float height,
                          unsigned int maxChildren, unsigned int minChildren,
-                         float buffer)
+                         float buffer, RTreeSplit split)
         : rect(Rect(x, y, width, height)),
             maxPerLevel(maxChildren),
             minPerLevel(minChildren),
             bufferSize(buffer),
-            root(std::make_shared<RTreeNode>(
-                    x, y, width, height, std::vector<std::shared_ptr<RTreeNode>>{}, 0)),
-            objectToBBox(){};
+            split(split),
+            // a node holds one extra child until it is split
+            nodes(maxChildren + 1),
+            root(nodes.acquire(0)),
+            objectCount(0),
+            reinsertedLevels(0),
+            maxEscapedFraction(0.01f),
+            maxChangedFraction(1.0f),
+            changed(0),
+            staleness(0),
+            backgroundRebuild(false),
+            maxStaleUpdates(4),
+            staleUpdates(0),
+            building(false),
+            built(false),
+            backNodes(maxChildren + 1),
+            backRoot(RTREE_NONE),
+            tagsAddedDuringBuild(false),
+            buildThreads(std::max(std::thread::hardware_concurrency(), 1u)),
+            adaptivePadding(false),
+            paddingUpdates(32),
+            maxPadding(100){};
+
+/**
+ * Deletes this RTree, waiting for its background reconstruction, if any.
+ */
+RTree::~RTree() {
+    cancelRebuild();
+    releaseObjects();
+}
+
+/**
+ * Sets whether reconstructions are built on a background thread.
+ *
+ * The tree is then built from a snapshot of the bounding boxes while the
+ * previous tree keeps answering searches, and swapped in by the first
+ * update after it completes. Until then, searches inflate the radius they
+ * test nodes with by the largest distance an object moved out of its
+ * bounding box, so they return the same objects as an up-to-date tree.
+ *
+ * @param background Whether to rebuild in the background (default is false).
+ * @param maxStaleUpdates The number of updates a rebuild may take before
+ * update() waits for it.
+ */
+void RTree::setBackgroundRebuild(bool background, int maxStaleUpdates) {
+    if (!background && building) {
+        finishRebuild();
+    }
+    backgroundRebuild = background;
+    this->maxStaleUpdates = maxStaleUpdates;
+}
+
+/**
+ * Sets whether the bounding box of each object is padded by how far it
+ * moves per update instead of by the fixed padding of this RTree.
+ *
+ * The distance is the velocity set on the object, if any, or else the
+ * distance it moved in recent updates. Static objects then get tight boxes
+ * that searches do not pick up needlessly, and fast objects get boxes they
+ * do not leave every update. Boxes are resized when their objects escape
+ * them, when they are padded more than twice as much as their objects need,
+ * and when the tree is reconstructed.
+ *
+ * @param adaptive Whether to pad by velocity (default is false).
+ * @param updates The number of updates a moving object should stay inside
+ * its box.
+ * @param maxPadding The largest padding of an object.
+ */
+void RTree::setAdaptivePadding(bool adaptive, float updates, float maxPadding) {
+    if (adaptive && !adaptivePadding) {
+        // start observing from the current positions
+        for (RTreeIndex i = 0; i < objects.size(); i++) {
+            if (objects[i] != nullptr) {
+                positions[i] = objects[i]->rect.origin;
+                speeds[i] = bufferSize / updates;
+            }
+        }
+    }
+    adaptivePadding = adaptive;
+    paddingUpdates = updates;
+    this->maxPadding = maxPadding;
+}
 
 /**
  * Resets to an empty RTree.
  */
 void RTree::clear() {
-    root->deleteChildren();
-    root = std::make_shared<RTreeNode>(
-            rect.getMinX(), rect.getMinY(), rect.getMaxX(), rect.getMaxY(),
-            std::vector<std::shared_ptr<RTreeNode>>{}, 0);
+    cancelRebuild();
+    staleness = 0;
+    releaseObjects();
+    nodes.clear();
+    root = nodes.acquire(0);
+    changed = 0;
 }
 
 /**
@@ -496,11 +1351,133 @@ std::vector<std::shared_ptr<RTreeObject>> RTree::search(const Vec2 center, float
  * the search area.
  */
 std::vector<std::shared_ptr<RTreeObject>> RTree::search(const Vec2 center, float radius, int tag) {
+    MSG_TRACE_SCOPE_ARG("RTree::search", tag);
+    std::vector<std::shared_ptr<RTreeObject>> res;
+    searchEach(center, radius, tag, [&res](const std::shared_ptr<RTreeObject> &obj) {
+        res.push_back(obj);
+        return true;
+    });
+    return res;
+}
+
+/**
+ * Searches for objects within a given circular area that have the given
+ * tag, storing raw pointers to them in a buffer owned by the caller. The
+ * buffer is cleared first, so reusing it across queries does not allocate.
+ *
+ * The pointers are only valid while the objects stay in the tree.
+ *
+ * @param center The center of the circle to search.
+ * @param radius The radius of the circle to search.
+ * @param tag The tag of objects to return (-1 for all objects).
+ * @param res The buffer to store the objects in.
+ * @param maxResults The number of objects after which the search stops.
+ * @return The number of objects found.
+ */
+size_t RTree::search(const Vec2 center, float radius, int tag, std::vector<RTreeObject*> &res,
+                     size_t maxResults) {
+    MSG_TRACE_SCOPE_ARG("RTree::search", tag);
+    res.clear();
+    if (maxResults == 0) {
+        return 0;
+    }
+    searchEach(center, radius, tag, [&res, maxResults](const std::shared_ptr<RTreeObject> &obj) {
+        res.push_back(obj.get());
+        return res.size() < maxResults;
+    });
+    return res.size();
+}
+
+/**
+ * Searches for objects that intersect a given rectangle and have the
+ * given tag.
+ *
+ * @param area The rectangle to search.
+ * @param tag The tag of objects to return (-1 for all objects).
+ * @return A vector of shared pointers to RTreeObject instances intersecting
+ * the rectangle.
+ */
+std::vector<std::shared_ptr<RTreeObject>> RTree::search(const Rect &area, int tag) {
+    MSG_TRACE_SCOPE_ARG("RTree::search", tag);
     std::vector<std::shared_ptr<RTreeObject>> res;
-    findIntersections(*root, center, radius, tag, res);
+    searchEach(area, tag, [&res](const std::shared_ptr<RTreeObject> &obj) {
+        res.push_back(obj);
+        return true;
+    });
     return res;
 }
 
+/**
+ * Searches for objects that intersect a given rectangle and have the
+ * given tag, storing raw pointers to them in a buffer owned by the caller.
+ * The buffer is cleared first.
+ *
+ * @param area The rectangle to search.
+ * @param tag The tag of objects to return (-1 for all objects).
+ * @param res The buffer to store the objects in.
+ * @param maxResults The number of objects after which the search stops.
+ * @return The number of objects found.
+ */
+size_t RTree::search(const Rect &area, int tag, std::vector<RTreeObject*> &res,
+                     size_t maxResults) {
+    MSG_TRACE_SCOPE_ARG("RTree::search", tag);
+    res.clear();
+    if (maxResults == 0) {
+        return 0;
+    }
+    searchEach(area, tag, [&res, maxResults](const std::shared_ptr<RTreeObject> &obj) {
+        res.push_back(obj.get());
+        return res.size() < maxResults;
+    });
+    return res.size();
+}
+
+/**
+ * Returns the k objects nearest to a point that have the given tag,
+ * nearest first. The distance to an object is the distance to the
+ * closest point of its rectangle.
+ *
+ * @param point The point to search from.
+ * @param k The number of objects to return.
+ * @param tag The tag of objects to return (-1 for all objects).
+ * @param maxDistance The distance beyond which objects are not returned.
+ * @return The nearest objects, fewer than k if the tree has fewer in range.
+ */
+std::vector<std::shared_ptr<RTreeObject>> RTree::nearest(const Vec2 point, size_t k, int tag,
+                                                         float maxDistance) {
+    MSG_TRACE_SCOPE_ARG("RTree::nearest", tag);
+    findNearest(point, k, tag, maxDistance);
+    std::vector<std::shared_ptr<RTreeObject>> res;
+    res.reserve(nearestHits.size());
+    for (RTreeIndex obj : nearestHits) {
+        res.push_back(objects[obj]);
+    }
+    return res;
+}
+
+/**
+ * Stores raw pointers to the k objects nearest to a point that have the
+ * given tag in a buffer owned by the caller, nearest first. The buffer
+ * is cleared first.
+ *
+ * @param point The point to search from.
+ * @param k The number of objects to find.
+ * @param tag The tag of objects to find (-1 for all objects).
+ * @param res The buffer to store the objects in.
+ * @param maxDistance The distance beyond which objects are not found.
+ * @return The number of objects found.
+ */
+size_t RTree::nearest(const Vec2 point, size_t k, int tag, std::vector<RTreeObject*> &res,
+                      float maxDistance) {
+    MSG_TRACE_SCOPE_ARG("RTree::nearest", tag);
+    findNearest(point, k, tag, maxDistance);
+    res.clear();
+    for (RTreeIndex obj : nearestHits) {
+        res.push_back(objects[obj].get());
+    }
+    return res.size();
+}
+
 /**
  * Inserts an object into the R-Tree.
  *
@@ -509,19 +1486,12 @@ std::vector<std::shared_ptr<RTreeObject>> RTree::search(const Vec2 center, float
  * (default is 20).
  */
 void RTree::insert(std::shared_ptr<RTreeObject> obj) {
-    if(objectToBBox.find(obj) != objectToBBox.end()){
+    if (findObject(obj.get()) != RTREE_NONE) {
         return;
     }
-    insertHelper(*root, obj);
-    if (root->children.size() > maxPerLevel) {
-        std::shared_ptr<RTreeNode> newRoot = std::make_shared<RTreeNode>(
-                root->rect, std::vector<std::shared_ptr<RTreeNode>>{}, root->level + 1);
-        std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> nodes =
-                linearSplit(*root);
-        newRoot->addChild(nodes.first);
-        newRoot->addChild(nodes.second);
-        root = newRoot;
-    }
+    RTreeIndex slot = addObject(obj);
+    insertEntry(slot, boxes[slot]);
+    changed++;
 }
 
 /**
@@ -530,19 +1500,13 @@ void RTree::insert(std::shared_ptr<RTreeObject> obj) {
  * @param obj Shared pointer to the RTreeObject to be removed.
  */
 void RTree::remove(std::shared_ptr<RTreeObject> obj) {
-    std::vector<std::shared_ptr<RTreeObject>> toReinsert =
-            removeHelper(root, obj);
-    for (auto it = toReinsert.begin(); it != toReinsert.end(); ++it) {
-        insert(*it);
-    }
-
-    if (root->children.size() == 1 && root->level > 0) {
-        Rect prevBBox = root->rect;
-        root = root->children[0];
-        root->rect = prevBBox;
+    RTreeIndex slot = findObject(obj.get());
+    if (slot == RTREE_NONE) {
+        return;
     }
-
-    objectToBBox.erase(obj);
+    removeEntry(slot, boxes[slot]);
+    releaseObject(slot);
+    changed++;
 }
 
 /**
@@ -551,58 +1515,144 @@ void RTree::remove(std::shared_ptr<RTreeObject> obj) {
  * @param objects List of objects to insert.
  */
 void RTree::bulkInsert(std::vector<std::shared_ptr<RTreeObject>> objects) {
-    std::vector<std::shared_ptr<RTreeNode>> nodes;
-    std::unordered_map<std::shared_ptr<RTreeObject>, Rect> newMap;
-    objectToBBox.swap(newMap);
+    cancelRebuild();
+    releaseObjects();
     for (auto it = objects.begin(); it != objects.end(); ++it) {
-        auto obj = *it;
-        Rect containerRect =
-                Rect(obj->rect.getMinX() - bufferSize, obj->rect.getMinY() - bufferSize,
-                         obj->rect.size.width + bufferSize * 2,
-                         obj->rect.size.height + bufferSize * 2);
-        std::vector<std::shared_ptr<RTreeNode>> emptyVector;
-        std::shared_ptr<RTreeNode> containerNode =
-                std::make_shared<RTreeNode>(containerRect, emptyVector, -1);
-        containerNode->obj = obj;
-        nodes.push_back(containerNode);
-        objectToBBox.insert(std::make_pair(obj, containerRect));
+        if (findObject(it->get()) == RTREE_NONE) {
+            addObject(*it);
+        }
     }
-
-    std::shared_ptr<RTreeNode> newRoot = sortTileRecursive(nodes);
-
-    root = newRoot;
+    reconstruct();
 }
 
 /**
  * Reconstructs this RTree using all of its existing points.
+ *
+ * The nodes are rebuilt in the memory of the previous tree, and the objects
+ * keep their slots, so reconstructing a tree whose size did not grow does
+ * not allocate.
  */
 void RTree::reconstruct() {
-    root->deleteChildren();
-    std::vector<std::shared_ptr<RTreeObject>> objects;
-    for (auto it = objectToBBox.begin(); it != objectToBBox.end(); ++it) {
-        objects.push_back(it->first);
+    MSG_TRACE_SCOPE("RTree::reconstruct");
+    cancelRebuild();
+    staleness = 0;
+    nodes.clear();
+    strEntries.clear();
+    strTags.assign(objects.size(), 0);
+    for (RTreeIndex i = 0; i < objects.size(); i++) {
+        if (objects[i] != nullptr) {
+            boxes[i] = getContainer(i);
+            strEntries.push_back({boxes[i], i});
+            strTags[i] = objects[i]->getTagMask();
+        }
     }
-    bulkInsert(objects);
+    root = sortTileRecursive(nodes, strEntries, strParents, strTags, buildThreads);
+    changed = 0;
 }
 
 /**
  * Updates this RTree depending on the state of its objects.
  *
- * If one of the objects in the RTree is no longer contained in its bounding
- * box, the RTree is reconstructed.
+ * Objects that are no longer contained in their bounding boxes are removed
+ * and reinserted with new bounding boxes. If too many objects escaped in
+ * this update, or too many changed since the last reconstruction, the
+ * RTree is reconstructed instead, in the background if enabled. With
+ * adaptive padding, objects that slowed down are also given tighter boxes,
+ * as long as few enough objects changed since the last reconstruction.
  */
 void RTree::update() {
-    for (auto it = objectToBBox.begin(); it != objectToBBox.end(); ++it) {
-        Rect objectRect = it->first->rect;
-        Rect bboxRect = it->second;
+    MSG_TRACE_SCOPE("RTree::update");
+    if (building && (built || ++staleUpdates > maxStaleUpdates)) {
+        finishRebuild();
+    }
 
-        if (!objectRect.inside(bboxRect)) {
-            reconstruct();
-            break;
+    escaped.clear();
+    oversized.clear();
+    staleness = 0;
+    // a linear sweep of the bounds table; removed objects have no box to leave
+    for (RTreeIndex i = 0; i < objects.size(); i++) {
+        const RTreeObject *obj = objects[i].get();
+        if (obj == nullptr) {
+            continue;
+        }
+        if (adaptivePadding) {
+            Vec2 &last = positions[i];
+            float moved = std::max(std::abs(obj->rect.origin.x - last.x), std::abs(obj->rect.origin.y - last.y));
+            speeds[i] += (moved - speeds[i]) * PADDING_SMOOTHING;
+            last = obj->rect.origin;
+        }
+
+        RTreeBox objectBox(obj->rect);
+        const RTreeBox &box = boxes[i];
+
+        // how far the object is outside of its box, which searches make up for
+        float dx = std::max(std::max(box.minX - objectBox.minX, objectBox.maxX - box.maxX), 0.0f);
+        float dy = std::max(std::max(box.minY - objectBox.minY, objectBox.maxY - box.maxY), 0.0f);
+        if (dx > 0 || dy > 0) {
+            escaped.push_back(i);
+            staleness = std::max(staleness, std::sqrt(dx * dx + dy * dy));
+        } else if (adaptivePadding) {
+            // the padding the box was made with, which an object that slowed down no longer needs
+            float padding = std::min(objectBox.minX - box.minX + box.maxX - objectBox.maxX,
+                                     objectBox.minY - box.minY + box.maxY - objectBox.maxY) / 2;
+            if (padding > OVERSIZED_PADDING * getPadding(i) && padding > MIN_SHRUNK_PADDING * maxPadding) {
+                oversized.push_back(i);
+            }
         }
     }
+    if (building) {
+        // a running rebuild will replace the tree anyway, so searches make up for the escapes
+        return;
+    }
+
+    float size = (float)objectCount;
+    if (!escaped.empty()) {
+        if (escaped.size() > maxEscapedFraction * size
+                || changed + escaped.size() > maxChangedFraction * size) {
+            if (backgroundRebuild) {
+                startRebuild();
+            } else {
+                reconstruct();
+            }
+            return;
+        }
+
+        // removing an object refits the boxes of its ancestors on the way up
+        for (RTreeIndex slot : escaped) {
+            removeEntry(slot, boxes[slot]);
+            boxes[slot] = getContainer(slot);
+            insertEntry(slot, boxes[slot]);
+        }
+        changed += escaped.size();
+        staleness = 0;
+    }
+
+    // shrinking boxes is optional, so it only uses what is left of the changes allowed
+    float budget = maxChangedFraction * size - changed;
+    size_t shrunk = budget > 0 ? std::min(oversized.size(), (size_t)budget) : 0;
+    for (size_t j = 0; j < shrunk; j++) {
+        RTreeIndex slot = oversized[j];
+        removeEntry(slot, boxes[slot]);
+        boxes[slot] = getContainer(slot);
+        insertEntry(slot, boxes[slot]);
+    }
+    changed += shrunk;
 }
 
+#ifndef MSG_HEADLESS
 void RTree::draw(const std::shared_ptr<SpriteBatch> &batch) {
-    root->draw(batch);
+    drawNode(batch, root);
+}
+
+void RTree::drawNode(const std::shared_ptr<SpriteBatch> &batch, RTreeIndex n) {
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        Rect rect = nodes.getChildBox(n, i).toRect();
+        Rect r = Rect((rect.origin.x) / 1024, (rect.origin.y) / 576,
+                      (rect.size.width) / 1024, (rect.size.height) / 576);
+        batch->outline(r);
+        if (nodes[n].level > 0) {
+            drawNode(batch, nodes.getChild(n, i));
+        }
+    }
 }
+#endif
@@ -31,19 +31,75 @@
 #ifndef RTREE_H
 #define RTREE_H
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
+#include <thread>
 #include <vector>
 
 #include "rtreenode.h"
 #include "rtreeobject.h"
+#include "SpatialIndex.h"
 
-#include <cugl/cugl.h>
+#include "CUGLShim.h"
 
 using namespace cugl;
 
-class RTree {
+/**
+ * The algorithms an RTree uses to choose the node an object is inserted
+ * into, and to split nodes that overflow.
+ */
+enum class RTreeSplit {
+    /**
+     * Guttman's linear split. Objects go to the first child that contains
+     * them, or else to the child whose area grows least.
+     */
+    LINEAR,
+    /**
+     * Guttman's quadratic split, which seeds the new nodes with the pair of
+     * children that would waste the most area together. Objects go to the
+     * child whose area grows least.
+     */
+    QUADRATIC,
+    /**
+     * The R*-tree algorithm. Objects go to the child whose overlap with its
+     * siblings grows least, splits minimize margin and then overlap, and
+     * the first overflow at each level of an insertion reinserts the 30% of
+     * entries farthest from the center of the node instead of splitting it.
+     */
+    RSTAR
+};
+
+/**
+ * A node or object waiting in the queue of a nearest-neighbor search,
+ * ordered by its distance from the query point.
+ */
+class RTreeCandidate {
+public:
+    /** The distance from the query point to the box of the candidate. */
+    float distance;
+    /** Whether the candidate is an object instead of a node. */
+    bool object;
+    /** The index of the node or object. */
+    RTreeIndex index;
+
+    /**
+     * Returns true if this candidate comes out of the queue after the given
+     * one. Objects come out before nodes at the same distance, since those
+     * cannot hold anything closer.
+     *
+     * @param c The candidate to compare with.
+     */
+    bool operator<(const RTreeCandidate& c) const {
+        if (distance != c.distance) return distance > c.distance;
+        if (object != c.object) return c.object;
+        return index > c.index;
+    }
+};
+
+class RTree : public SpatialIndex {
 private:
     /** The bounding box of the entire RTree. */
     Rect rect;
@@ -57,114 +113,608 @@ private:
     /** The amount of padding on each side of the bounding box of each object. */
     unsigned int bufferSize;
 
-    /** Map with objects as keys and the corresponding bounding boxes as values. */
-    std::unordered_map<std::shared_ptr<RTreeObject>, Rect> objectToBBox;
+    /** The algorithm used to insert objects and split nodes. */
+    RTreeSplit split;
+
+    /** The nodes of this RTree. */
+    RTreeNodePool nodes;
+
+    /** The root node of this RTree. */
+    RTreeIndex root;
+
+    /**
+     * The bounds table: the objects in this RTree, with nullptr in the slots
+     * of removed objects, indexed by the children of nodes at level 0. Each
+     * object keeps its slot until it is removed.
+     */
+    std::vector<std::shared_ptr<RTreeObject>> objects;
+
+    /** The padded bounding boxes of the objects, indexed like objects. */
+    std::vector<RTreeBox> boxes;
+
+    /** The lower-left corners of the objects at the last update, indexed like objects. */
+    std::vector<Vec2> positions;
+
+    /** The smoothed distances the objects moved per update, indexed like objects. */
+    std::vector<float> speeds;
+
+    /** The number of objects in this RTree. */
+    size_t objectCount;
+
+    /** The slots of removed objects, which are reused before objects grows. */
+    std::vector<RTreeIndex> freeObjects;
+
+    /** The entries of the level being built by reconstruct. */
+    std::vector<RTreeEntry> strEntries;
+
+    /** The parents of the level being built by reconstruct. */
+    std::vector<RTreeEntry> strParents;
+
+    /** The children of the node being split. */
+    std::vector<RTreeEntry> splitEntries;
+
+    /** Which entries of splitEntries have been assigned to a new node. */
+    std::vector<bool> splitAdded;
+
+    /** Which entries of splitEntries go to the second new node. */
+    std::vector<bool> splitSecond;
+
+    /** The positions of splitEntries, sorted along an axis by rstarSplit. */
+    std::vector<size_t> splitOrder;
+
+    /** The boxes of the first k sorted entries, for every k, used by rstarSplit. */
+    std::vector<RTreeBox> splitPrefix;
+
+    /** The boxes of the sorted entries from k on, for every k, used by rstarSplit. */
+    std::vector<RTreeBox> splitSuffix;
+
+    /** The levels at which entries were reinserted during the current insertion. */
+    uint64_t reinsertedLevels;
+
+    /** Entries removed by forceReinsert, with the levels to reinsert them at. */
+    std::vector<std::pair<RTreeEntry, int>> reinserts;
+
+    /** The objects to reinsert after a removal. */
+    std::vector<RTreeIndex> orphans;
+
+    /** The tag masks of the objects, indexed like objects, used by reconstruct. */
+    std::vector<uint64_t> strTags;
+
+    /** The heap of nodes and objects to visit in a nearest-neighbor search. */
+    std::vector<RTreeCandidate> nearestQueue;
+
+    /** The distances of the k nearest objects queued so far, as a max-heap. */
+    std::vector<float> nearestBound;
+
+    /** The objects found by a nearest-neighbor search, nearest first. */
+    std::vector<RTreeIndex> nearestHits;
+
+    /** The objects that left their bounding boxes, found by update(). */
+    std::vector<RTreeIndex> escaped;
+
+    /** The objects whose bounding boxes are padded far more than they need, found by update(). */
+    std::vector<RTreeIndex> oversized;
+
+    /** The fraction of objects that may escape in one update before the tree is reconstructed. */
+    float maxEscapedFraction;
+
+    /** The fraction of objects that may change between reconstructions. */
+    float maxChangedFraction;
+
+    /** The number of objects inserted, removed or moved since the last reconstruction. */
+    size_t changed;
+
+    /**
+     * The largest distance by which an object has left its bounding box. Searches
+     * test node boxes with a radius inflated by this much, so that they find
+     * objects that the tree has not caught up with yet.
+     */
+    float staleness;
+
+    /** Whether reconstructions are built on a background thread. */
+    bool backgroundRebuild;
+
+    /** The number of updates a background reconstruction may take before update() waits for it. */
+    int maxStaleUpdates;
+
+    /** The number of updates since the running background reconstruction started. */
+    int staleUpdates;
+
+    /** Whether a background reconstruction is running. */
+    bool building;
+
+    /**
+     * The slots of objects removed since the running background reconstruction
+     * started. They are not reused until the new tree no longer contains them.
+     */
+    std::vector<RTreeIndex> freedDuringBuild;
+
+    /** Set by the builder thread when the background reconstruction is complete. */
+    std::atomic<bool> built;
+
+    /** The thread of the running background reconstruction. */
+    std::thread builder;
+
+    /** The nodes of the tree built in the background, swapped with nodes when it completes. */
+    RTreeNodePool backNodes;
+
+    /** The root of the tree built in the background. */
+    RTreeIndex backRoot;
+
+    /** The bounding boxes of the objects when the snapshot was taken, indexed like objects. */
+    std::vector<RTreeBox> backBoxes;
+
+    /** The tag masks of the objects when the snapshot was taken, indexed like objects. */
+    std::vector<uint64_t> backTags;
+
+    /** Whether a tag was added to an object since the snapshot was taken. */
+    bool tagsAddedDuringBuild;
+
+    /** The entries of the level being built in the background. */
+    std::vector<RTreeEntry> backEntries;
+
+    /** The parents of the level being built in the background. */
+    std::vector<RTreeEntry> backParents;
+
+    /** The largest number of threads that reconstructions are built with. */
+    unsigned buildThreads;
+
+    /** Whether the padding of each object follows how far it moves per update. */
+    bool adaptivePadding;
+
+    /** The number of updates a moving object should stay inside its padded box with adaptive padding. */
+    float paddingUpdates;
+
+    /** The largest padding of an object with adaptive padding. */
+    float maxPadding;
+
+    /**
+     * Returns the padding on each side of the bounding box of an object: the
+     * distance it moves in paddingUpdates updates with adaptive padding, and
+     * bufferSize otherwise.
+     *
+     * @param slot The slot of the object.
+     */
+    float getPadding(RTreeIndex slot) const;
+
+    /**
+     * Returns the bounding box of an object in this RTree, which is the box
+     * of the object padded on each side.
+     *
+     * @param slot The slot of the object.
+     */
+    RTreeBox getContainer(RTreeIndex slot) const;
 
     /**
-     * Fills a vector with objects in a subtree that intersect with a given
-     * circular area and subscribe to a given tag.
+     * Calls a visitor on the objects in a subtree that intersect with a given
+     * circular area and subscribe to a given tag, until it returns false.
      *
      * @param n The root of the subtree.
      * @param center The center of the circle.
      * @param radius The radius of the circle.
-     * @param tag The tag of objects to return (-1 for all objects).
-     * @param res Vector containing objects that intersect the area.
+     * @param reach The radius to test node boxes with, the radius plus staleness.
+     * @param tag The tag of objects to visit (-1 for all objects).
+     * @param tagBit The bit of the tag in tag masks, or 0 for all objects.
+     * @param visitor The function to call on each object.
+     * @return false if the visitor stopped the search.
+     */
+    template <typename Visitor>
+    bool findIntersections(RTreeIndex n, const Vec2 center, float radius, float reach, int tag,
+                           uint64_t tagBit, Visitor &visitor) {
+        const RTreeNode &node = nodes[n];
+
+        // test the bounds of all children at once, then visit only the hits
+        for (size_t first = 0; first < node.count; first += 64) {
+            uint64_t mask = nodes.intersectChildren(n, first, center, reach);
+            while (mask != 0) {
+                size_t i = first + rtreeLowestBit(mask);
+                mask &= mask - 1;
+                if (tagBit != 0 && (nodes.getChildTags(n, i) & tagBit) == 0) {
+                    continue;
+                }
+
+                RTreeIndex child = nodes.getChild(n, i);
+                if (node.level == 0) {
+                    // the padded box contains the object, so only its hits are checked exactly
+                    const std::shared_ptr<RTreeObject> &obj = objects[child];
+                    if (obj->rect.doesIntersect(center, radius) && hasTag(*obj, tag, tagBit) &&
+                        !visitor(obj)) {
+                        return false;
+                    }
+                } else if (!findIntersections(child, center, radius, reach, tag, tagBit, visitor)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Calls a visitor on the objects in a subtree that intersect with a given
+     * rectangle and subscribe to a given tag, until it returns false.
+     *
+     * @param n The root of the subtree.
+     * @param area The rectangle.
+     * @param reach The box to test node boxes with, the rectangle grown by staleness.
+     * @param tag The tag of objects to visit (-1 for all objects).
+     * @param tagBit The bit of the tag in tag masks, or 0 for all objects.
+     * @param visitor The function to call on each object.
+     * @return false if the visitor stopped the search.
+     */
+    template <typename Visitor>
+    bool findOverlaps(RTreeIndex n, const Rect &area, const RTreeBox &reach, int tag,
+                      uint64_t tagBit, Visitor &visitor) {
+        const RTreeNode &node = nodes[n];
+        for (size_t first = 0; first < node.count; first += 64) {
+            uint64_t mask = nodes.overlapChildren(n, first, reach);
+            while (mask != 0) {
+                size_t i = first + rtreeLowestBit(mask);
+                mask &= mask - 1;
+                if (tagBit != 0 && (nodes.getChildTags(n, i) & tagBit) == 0) {
+                    continue;
+                }
+
+                RTreeIndex child = nodes.getChild(n, i);
+                if (node.level == 0) {
+                    const std::shared_ptr<RTreeObject> &obj = objects[child];
+                    if (obj->rect.doesIntersect(area) && hasTag(*obj, tag, tagBit) && !visitor(obj)) {
+                        return false;
+                    }
+                } else if (!findOverlaps(child, area, reach, tag, tagBit, visitor)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Returns true if an object subscribes to a tag.
+     *
+     * @param obj The object.
+     * @param tag The tag (-1 for all objects).
+     * @param tagBit The bit of the tag in tag masks, or 0 for all objects.
+     */
+    static bool hasTag(RTreeObject &obj, int tag, uint64_t tagBit) {
+        if (tagBit == 0) {
+            return true;
+        }
+        return (obj.getTagMask() & tagBit) != 0 && (rtreeTagIsExact(tag) || obj.containsTag(tag));
+    }
+
+    /**
+     * Returns the tag mask of the object in a slot of the bounds table. A
+     * reconstruction that finishes may still contain the slots of objects
+     * removed while it was built, which have no tags.
+     *
+     * @param slot The slot of the object.
+     */
+    uint64_t getObjectTags(RTreeIndex slot) const {
+        return objects[slot] == nullptr ? 0 : objects[slot]->getTagMask();
+    }
+
+    /**
+     * Adds a child to a node with the tag mask of the child.
+     *
+     * @param n The node.
+     * @param child The child, an object if the node is at level 0.
+     * @param box The bounding box of the child.
+     */
+    void addChild(RTreeIndex n, RTreeIndex child, const RTreeBox &box) {
+        nodes.addChild(n, child, box,
+                       nodes[n].level == 0 ? getObjectTags(child) : nodes.getTags(child));
+    }
+
+    /**
+     * Recomputes the tag masks of a subtree from its objects.
+     *
+     * @param n The root of the subtree.
+     * @return The union of the tag masks of the children of the root.
+     */
+    uint64_t refreshTags(RTreeIndex n);
+
+    /**
+     * Adds the bits of tags that were added to an object to the tag masks of
+     * the nodes above it.
+     *
+     * @param obj The slot of the object.
+     * @param bits The bits of the tags.
+     */
+    void addObjectTag(RTreeIndex obj, uint64_t bits);
+
+    /**
+     * Searches for an object in a given node, and if it is found, adds the bits
+     * of tags to the tag masks of the path to it.
+     *
+     * @param n The node to search.
+     * @param obj The slot of the object.
+     * @param containerBox The bounding box of the object.
+     * @param bits The bits of the tags.
+     * @return true if the object was found.
+     */
+    bool addTagHelper(RTreeIndex n, RTreeIndex obj, const RTreeBox &containerBox, uint64_t bits);
+
+    friend class RTreeObject;
+
+    /**
+     * Fills nearestHits with the k objects nearest to a point that subscribe
+     * to a given tag, nearest first, by visiting nodes in order of their
+     * distance from the point.
+     *
+     * @param point The point to search from.
+     * @param k The number of objects to find.
+     * @param tag The tag of objects to find (-1 for all objects).
+     * @param maxDistance The distance beyond which objects are not found.
      */
-    void findIntersections(RTreeNode &n,
-        const Vec2 center, float radius, int tag,
-            std::vector<std::shared_ptr<RTreeObject>> &res);
+    void findNearest(const Vec2 point, size_t k, int tag, float maxDistance);
 
     /**
-     * Given a node to split, selects two children of the original node to become
-     * the first children of the two new nodes.
+     * Given the children of a node to split, selects two of them to become the
+     * first children of the two new nodes.
      *
-     * @param n The node to split
-     * @return Pair of RTreeNode shared pointers containing the first two elements of the two new nodes
+     * @param entries The children of the node to split
+     * @param box The bounding box of the node to split
+     * @return The positions in entries of the first children of the two new nodes
      */
-    std::pair <std::shared_ptr<RTreeNode>,
-    std::shared_ptr<RTreeNode>> pickSeeds(RTreeNode &n);
+    std::pair<size_t, size_t> pickSeeds(const std::vector<RTreeEntry> &entries, const RTreeBox &box);
 
     /**
      * Selects one remaining child of the node to be split to be added to a newly
      * split node.
      *
-     * @param children Vector of children of the node to be split
-     * @param added Set of children already assigned to a new node
+     * @param entries The children of the node to be split
+     * @param added Which children are already assigned to a new node
      * @param bbox_1 The bounding box of the first new node
      * @param bbox_2 The bounding box of the second new node
-     * @return RTreeNode* The next child to be added to a new node
+     * @return The position in entries of the next child to be added to a new node
      */
-    std::shared_ptr<RTreeNode> pickNext(const std::vector<std::shared_ptr<RTreeNode>> &children,
-        const std::unordered_set <std::shared_ptr<RTreeNode>> &added, const Rect &bbox_1, const Rect &bbox_2);
+    size_t pickNext(const std::vector<RTreeEntry> &entries, const std::vector<bool> &added,
+        const RTreeBox &bbox_1, const RTreeBox &bbox_2);
 
     /**
-     * Splits an overflowing node into two nodes.
+     * Splits an overflowing node into two nodes. The node keeps the children of
+     * the first node, and a new node receives the rest.
      *
      * @param n The node to be split.
+     * @param box The bounding box of the node to be split.
      * @return The two resulting nodes from the split.
      */
-    std::pair <std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> linearSplit(RTreeNode &n);
-    
+    std::pair<RTreeIndex, RTreeIndex> linearSplit(RTreeIndex n, const RTreeBox &box);
+
+    /**
+     * Splits an overflowing node into two nodes with Guttman's quadratic split.
+     *
+     * @param n The node to be split.
+     * @return The two resulting nodes from the split.
+     */
+    std::pair<RTreeIndex, RTreeIndex> quadraticSplit(RTreeIndex n);
+
+    /**
+     * Splits an overflowing node into two nodes with the R*-tree split, which
+     * picks the axis with the smallest margins, and then the distribution
+     * along it with the least overlap.
+     *
+     * @param n The node to be split.
+     * @return The two resulting nodes from the split.
+     */
+    std::pair<RTreeIndex, RTreeIndex> rstarSplit(RTreeIndex n);
+
+    /**
+     * Splits an overflowing node into two nodes with the algorithm of this RTree.
+     *
+     * @param n The node to be split.
+     * @param box The bounding box of the node to be split.
+     * @return The two resulting nodes from the split.
+     */
+    std::pair<RTreeIndex, RTreeIndex> splitNode(RTreeIndex n, const RTreeBox &box);
+
+    /**
+     * Copies the children of a node into splitEntries.
+     *
+     * @param n The node to be split.
+     */
+    void loadSplitEntries(RTreeIndex n);
+
     /**
-     * Given a rectangle, determine the child bounding box such that the union of the new rectangle and
+     * Moves the entries of splitSecond to a new node, keeping the others in
+     * the node being split.
+     *
+     * @param n The node to be split.
+     * @return The two resulting nodes from the split.
+     */
+    std::pair<RTreeIndex, RTreeIndex> distributeSplit(RTreeIndex n);
+
+    /**
+     * Returns the smallest number of children of the nodes created by a split
+     * of splitEntries.
+     */
+    size_t splitMinimum() const;
+
+    /**
+     * Given a box, determine the child bounding box such that the union of the new box and
      * child bounding box is minimal.
      *
      * @param n The parent of the candidate child nodes to be checked.
-     * @param containerRect The bounding box of the object to be inserted
-     * @return The node that can expand to fit containerRect with minimal area increase.
+     * @param containerBox The bounding box of the object to be inserted
+     * @return The position of the child that can expand to fit containerBox with minimal area increase.
      */
-    std::shared_ptr<RTreeNode> findBestBB(RTreeNode &n, const Rect &containerRect);
-    
+    size_t findBestBB(RTreeIndex n, const RTreeBox &containerBox);
+
+    /**
+     * Chooses the child of a node to insert a box into, with the algorithm
+     * of this RTree.
+     *
+     * @param n The node into which the box will be inserted.
+     * @param containerBox The box to insert.
+     * @return The position of the chosen child.
+     */
+    size_t chooseSubtree(RTreeIndex n, const RTreeBox &containerBox);
+
+    /**
+     * Removes the children of a child of a node that are farthest from its
+     * center, and queues them in reinserts, as the R*-tree does with the
+     * first node that overflows at each level of an insertion.
+     *
+     * @param n The parent of the overflowing node.
+     * @param i The position of the overflowing node in its parent.
+     */
+    void forceReinsert(RTreeIndex n, size_t i);
+
+    /**
+     * Inserts an entry into a node.
+     *
+     * @param n The node into which the entry will be inserted.
+     * @param entry The index of the object or node to insert.
+     * @param containerBox The bounding box of the entry.
+     * @param tags The tag mask of the entry.
+     * @param level The level of the node that receives the entry; 0 for objects.
+     */
+    void insertHelper(RTreeIndex n, RTreeIndex entry, const RTreeBox &containerBox, uint64_t tags,
+                      int level);
+
+    /**
+     * Inserts an entry into the tree at the given level, splitting the root
+     * if it overflows.
+     *
+     * @param entry The index of the object or node to insert.
+     * @param containerBox The bounding box of the entry.
+     * @param level The level of the node that receives the entry; 0 for objects.
+     */
+    void insertAtLevel(RTreeIndex entry, const RTreeBox &containerBox, int level);
+
+    /**
+     * Inserts an object into the tree, splitting the root if it overflows.
+     *
+     * @param obj The index of the object to insert.
+     * @param containerBox The bounding box of the object.
+     */
+    void insertEntry(RTreeIndex obj, const RTreeBox &containerBox);
+
+    /**
+     * Returns the slot of an object in the bounds table, or RTREE_NONE if it
+     * is not in this RTree.
+     *
+     * @param obj The object.
+     */
+    RTreeIndex findObject(const RTreeObject *obj) const;
+
+    /**
+     * Stores an object and its padded bounding box in the bounds table,
+     * reusing the slot of a removed object if there is one.
+     *
+     * @param obj The object to store.
+     * @return The slot of the object.
+     */
+    RTreeIndex addObject(const std::shared_ptr<RTreeObject> &obj);
+
     /**
-     * Inserts an object into a node.
+     * Removes an object from the bounds table. Its slot is reused once no
+     * tree contains it anymore.
      *
-     * @param n The node into which the object will be inserted.
-     * @param obj The object to insert.
+     * @param slot The slot of the object.
      */
-    void insertHelper(RTreeNode &n, std::shared_ptr<RTreeObject> &obj);
+    void releaseObject(RTreeIndex slot);
+
+    /**
+     * Removes every object from the bounds table.
+     */
+    void releaseObjects();
+
+    /**
+     * Removes an object from the tree, reinserting the objects of any node
+     * that underflows and shrinking the root if it is left with one child.
+     *
+     * @param obj The slot of the object to remove.
+     * @param containerBox The bounding box of the object.
+     */
+    void removeEntry(RTreeIndex obj, const RTreeBox &containerBox);
 
     /**
      * Searches for an object in a given node, and if it is found, removes it.
      *
-     * If removing the object causes the node to have too few children, the
-     * remaining children are removed and returned.
+     * If removing the object causes a child to have too few children, that child
+     * is removed, and the objects below it are added to orphans to be reinserted.
      *
      * @param n The node to search.
-     * @param obj The object to be removed.
-     * @return A list of objects to reinsert into the tree.
+     * @param obj The slot of the object to be removed.
+     * @param containerBox The bounding box of the object.
+     * @return true if the object was found and removed.
      */
-    std::vector<std::shared_ptr<RTreeObject>> removeHelper(std::shared_ptr<RTreeNode> &n, std::shared_ptr<RTreeObject> &obj);
-    
+    bool removeHelper(RTreeIndex n, RTreeIndex obj, const RTreeBox &containerBox);
+
     /**
-     * Partition a list of child nodes into a certain amount of new parent nodes.
+     * Releases the nodes of a subtree, adding the objects below it to orphans.
      *
-     * @param nodes Vector of nodes to be partitioned
-     * @return Vector of the new children nodes
+     * @param n The root of the subtree.
      */
-    std::vector<std::shared_ptr<RTreeNode>> strSplit(std::vector<std::shared_ptr<RTreeNode>> &nodes, int level);
-    
+    void collectOrphans(RTreeIndex n);
+
+    /**
+     * Partition a list of entries into a certain amount of new parent nodes.
+     *
+     * The entries are sorted, and the slices packed, with up to the given number
+     * of threads. The result does not depend on the number of threads.
+     *
+     * This only touches its arguments, so it can run on the builder thread.
+     *
+     * @param pool The pool to acquire the new parent nodes from
+     * @param entries Vector of entries to be partitioned
+     * @param parents Vector to fill with the new parent nodes
+     * @param tags The tag masks of the objects, by index
+     * @param level The level of the new parent nodes
+     * @param threads The largest number of threads to use
+     */
+    void strSplit(RTreeNodePool &pool, std::vector<RTreeEntry> &entries,
+        std::vector<RTreeEntry> &parents, const std::vector<uint64_t> &tags, int level,
+        unsigned threads) const;
+
     /**
-     * Build an R-Tree from the bottom up using a list of nodes.
+     * Build an R-Tree from the bottom up using a list of objects.
      *
      * Uses the Sort-Tile-Recursive (STR) algorithm to build an rtree using a bulk
      * insertion. This builds trees faster than inserting objects one-by-one and
      * results in less overlaps between subtrees.
      *
-     * Precondition: nodes is non-empty.
+     * This only touches its arguments, so it can run on the builder thread.
      *
-     * @param nodes The list of nodes to be bulk inserted into the RTree.
+     * @param pool The pool to acquire the nodes from
+     * @param entries The objects to insert, which are reordered
+     * @param parents Scratch space for the levels above the objects
+     * @param tags The tag masks of the objects, by index
+     * @param threads The largest number of threads to use
      * @return The root node of the new RTree.
      */
-    std::shared_ptr<RTreeNode> sortTileRecursive(std::vector<std::shared_ptr<RTreeNode>> &nodes);
+    RTreeIndex sortTileRecursive(RTreeNodePool &pool, std::vector<RTreeEntry> &entries,
+        std::vector<RTreeEntry> &parents, const std::vector<uint64_t> &tags,
+        unsigned threads) const;
 
-public:
-    /** The root node of this RTree. */
-    std::shared_ptr<RTreeNode> root;
+    /**
+     * Snapshots the bounding boxes of the objects and starts building a tree
+     * from them on the builder thread.
+     */
+    void startRebuild();
+
+    /**
+     * Waits for the background reconstruction and swaps its tree in. Objects
+     * that were inserted or removed while it was built are added or removed.
+     */
+    void finishRebuild();
+
+    /**
+     * Waits for the background reconstruction, if any, and throws its tree away.
+     */
+    void cancelRebuild();
 
+#ifndef MSG_HEADLESS
+    // Used for testing/visualization purposes. Should be removed before it's added to CUGL
+    void drawNode(const std::shared_ptr<SpriteBatch> &batch, RTreeIndex n);
+#endif
+
+public:
     /**
      * Resets to an empty RTree.
      */
-    void clear();
+    void clear() override;
 
     /**
      * Creates an RTree.
@@ -179,10 +729,16 @@ public:
      * @param maxChildren Maximum number of children per node (default is 5).
      * @param minChildren Minimum number of children per node (default is 2).
      * @param buffer The amount of padding on each side of the bounding box of each object.
+     * @param split The algorithm used to insert objects and split nodes (default is LINEAR).
      */
     RTree(float x, float y, float width, float height,
                              unsigned int maxChildren = 5, unsigned int minChildren = 2,
-                             float buffer = 20);
+                             float buffer = 20, RTreeSplit split = RTreeSplit::LINEAR);
+
+    /**
+     * Deletes this RTree, waiting for its background reconstruction, if any.
+     */
+    ~RTree() override;
 
     /**
      * Searches for objects within a given circular area.
@@ -203,7 +759,116 @@ public:
      * @return A vector of shared pointers to RTreeObject instances intersecting
      * the search area that subscribe to the given tag.
      */
-    std::vector<std::shared_ptr<RTreeObject>> search(const Vec2 center, float radius, int tag);
+    std::vector<std::shared_ptr<RTreeObject>> search(const Vec2 center, float radius, int tag) override;
+
+    /**
+     * Searches for objects within a given circular area that have the given
+     * tag, storing raw pointers to them in a buffer owned by the caller. The
+     * buffer is cleared first, so reusing it across queries does not allocate.
+     *
+     * The pointers are only valid while the objects stay in the tree.
+     *
+     * @param center The center of the circle to search.
+     * @param radius The radius of the circle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @param res The buffer to store the objects in.
+     * @param maxResults The number of objects after which the search stops.
+     * @return The number of objects found.
+     */
+    size_t search(const Vec2 center, float radius, int tag, std::vector<RTreeObject*> &res,
+                  size_t maxResults = SIZE_MAX) override;
+
+    /**
+     * Calls a visitor on the objects within a given circular area that have
+     * the given tag, without collecting them. The visitor is called with a
+     * const std::shared_ptr<RTreeObject>& and returns false to stop the search.
+     *
+     * The visitor must not insert, remove or update objects of this tree.
+     *
+     * @param center The center of the circle to search.
+     * @param radius The radius of the circle to search.
+     * @param tag The tag of objects to visit (-1 for all objects).
+     * @param visitor The function to call on each object.
+     * @return false if the visitor stopped the search.
+     */
+    template <typename Visitor>
+    bool searchEach(const Vec2 center, float radius, int tag, Visitor &&visitor) {
+        return findIntersections(root, center, radius, radius + staleness, tag,
+                                 tag == -1 ? 0 : rtreeTagBit(tag), visitor);
+    }
+
+    /**
+     * Searches for objects that intersect a given rectangle and have the
+     * given tag.
+     *
+     * @param area The rectangle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @return A vector of shared pointers to RTreeObject instances intersecting
+     * the rectangle.
+     */
+    std::vector<std::shared_ptr<RTreeObject>> search(const Rect &area, int tag = -1);
+
+    /**
+     * Searches for objects that intersect a given rectangle and have the
+     * given tag, storing raw pointers to them in a buffer owned by the caller.
+     * The buffer is cleared first.
+     *
+     * @param area The rectangle to search.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @param res The buffer to store the objects in.
+     * @param maxResults The number of objects after which the search stops.
+     * @return The number of objects found.
+     */
+    size_t search(const Rect &area, int tag, std::vector<RTreeObject*> &res,
+                  size_t maxResults = SIZE_MAX);
+
+    /**
+     * Calls a visitor on the objects that intersect a given rectangle and have
+     * the given tag. The visitor is called with a const
+     * std::shared_ptr<RTreeObject>& and returns false to stop the search.
+     *
+     * The visitor must not insert, remove or update objects of this tree.
+     *
+     * @param area The rectangle to search.
+     * @param tag The tag of objects to visit (-1 for all objects).
+     * @param visitor The function to call on each object.
+     * @return false if the visitor stopped the search.
+     */
+    template <typename Visitor>
+    bool searchEach(const Rect &area, int tag, Visitor &&visitor) {
+        RTreeBox reach(area.getMinX() - staleness, area.getMinY() - staleness,
+                       area.getMaxX() + staleness, area.getMaxY() + staleness);
+        return findOverlaps(root, area, reach, tag, tag == -1 ? 0 : rtreeTagBit(tag), visitor);
+    }
+
+    /**
+     * Returns the k objects nearest to a point that have the given tag,
+     * nearest first. The distance to an object is the distance to the
+     * closest point of its rectangle.
+     *
+     * @param point The point to search from.
+     * @param k The number of objects to return.
+     * @param tag The tag of objects to return (-1 for all objects).
+     * @param maxDistance The distance beyond which objects are not returned.
+     * @return The nearest objects, fewer than k if the tree has fewer in range.
+     */
+    std::vector<std::shared_ptr<RTreeObject>> nearest(const Vec2 point, size_t k, int tag = -1,
+                                                      float maxDistance = INFINITY);
+
+    /**
+     * Stores raw pointers to the k objects nearest to a point that have the
+     * given tag in a buffer owned by the caller, nearest first. The buffer
+     * is cleared first.
+     *
+     * @param point The point to search from.
+     * @param k The number of objects to find.
+     * @param tag The tag of objects to find (-1 for all objects).
+     * @param res The buffer to store the objects in.
+     * @param maxDistance The distance beyond which objects are not found.
+     * @return The number of objects found.
+     */
+    size_t nearest(const Vec2 point, size_t k, int tag, std::vector<RTreeObject*> &res,
+                   float maxDistance = INFINITY);
     
     
     /**
@@ -213,14 +878,14 @@ public:
      * @param buffer Optional buffer value to expand the object's bounding box
      * (default is 20).
      */
-    void insert(std::shared_ptr<RTreeObject> obj);
+    void insert(std::shared_ptr<RTreeObject> obj) override;
 
     /**
      * Removes an object from this RTree.
      *
      * @param obj Shared pointer to the RTreeObject to be removed.
      */
-    void remove(std::shared_ptr<RTreeObject> obj);
+    void remove(std::shared_ptr<RTreeObject> obj) override;
     
     /**
      * Bulk inserts a vector of objects.
@@ -237,13 +902,147 @@ public:
     /**
      * Updates this RTree depending on the state of its objects.
      *
-     * If one of the objects in the RTree is no longer contained in its bounding
-     * box, the RTree is reconstructed.
+     * Objects that are no longer contained in their bounding boxes are removed
+     * and reinserted with new bounding boxes. If too many objects escaped in
+     * this update, or too many changed since the last reconstruction, the
+     * RTree is reconstructed instead, in the background if enabled. With
+     * adaptive padding, objects that slowed down are also given tighter boxes,
+     * as long as few enough objects changed since the last reconstruction.
      */
-    void update();
+    void update() override;
 
+    /**
+     * Sets the fraction of objects that may escape their bounding boxes in
+     * one update before the RTree is reconstructed instead of updated
+     * incrementally. With 0, any escape reconstructs the RTree.
+     *
+     * @param fraction The fraction of objects (default is 0.01).
+     */
+    void setMaxEscapedFraction(float fraction) {
+        maxEscapedFraction = fraction;
+    }
+
+    /**
+     * Returns the fraction of objects that may escape their bounding boxes in
+     * one update before the RTree is reconstructed.
+     */
+    float getMaxEscapedFraction() const {
+        return maxEscapedFraction;
+    }
+
+    /**
+     * Sets the fraction of objects that may be inserted, removed or moved
+     * between reconstructions. Incremental changes leave more overlap between
+     * nodes than a bulk load, so the RTree is reconstructed once they add up
+     * to this fraction.
+     *
+     * @param fraction The fraction of objects (default is 1).
+     */
+    void setMaxChangedFraction(float fraction) {
+        maxChangedFraction = fraction;
+    }
+
+    /**
+     * Returns the fraction of objects that may be inserted, removed or moved
+     * between reconstructions.
+     */
+    float getMaxChangedFraction() const {
+        return maxChangedFraction;
+    }
+
+    /**
+     * Sets whether reconstructions are built on a background thread.
+     *
+     * The tree is then built from a snapshot of the bounding boxes while the
+     * previous tree keeps answering searches, and swapped in by the first
+     * update after it completes. Until then, searches inflate the radius they
+     * test nodes with by the largest distance an object moved out of its
+     * bounding box, so they return the same objects as an up-to-date tree.
+     *
+     * @param background Whether to rebuild in the background (default is false).
+     * @param maxStaleUpdates The number of updates a rebuild may take before
+     * update() waits for it.
+     */
+    void setBackgroundRebuild(bool background, int maxStaleUpdates = 4);
+
+    /**
+     * Returns the algorithm used to insert objects and split nodes.
+     */
+    RTreeSplit getSplit() const {
+        return split;
+    }
+
+    /**
+     * Returns true if reconstructions are built on a background thread.
+     */
+    bool isBackgroundRebuild() const {
+        return backgroundRebuild;
+    }
+
+    /**
+     * Returns true if a background reconstruction is running.
+     */
+    bool isRebuilding() const {
+        return building;
+    }
+
+    /**
+     * Sets the largest number of threads that reconstructions are built with.
+     * Large levels are sorted and packed in parallel; the resulting tree is
+     * the same for any number of threads.
+     *
+     * @param threads The number of threads (default is the number of cores).
+     */
+    void setBuildThreads(unsigned threads) {
+        buildThreads = std::max(threads, 1u);
+    }
+
+    /**
+     * Returns the largest number of threads that reconstructions are built with.
+     */
+    unsigned getBuildThreads() const {
+        return buildThreads;
+    }
+
+    /**
+     * Sets whether the bounding box of each object is padded by how far it
+     * moves per update instead of by the fixed padding of this RTree.
+     *
+     * The distance is the velocity set on the object, if any, or else the
+     * distance it moved in recent updates. Static objects then get tight boxes
+     * that searches do not pick up needlessly, and fast objects get boxes they
+     * do not leave every update. Boxes are resized when their objects escape
+     * them, when they are padded more than twice as much as their objects need,
+     * and when the tree is reconstructed.
+     *
+     * @param adaptive Whether to pad by velocity (default is false).
+     * @param updates The number of updates a moving object should stay inside
+     * its box.
+     * @param maxPadding The largest padding of an object.
+     */
+    void setAdaptivePadding(bool adaptive, float updates = 32, float maxPadding = 100);
+
+    /**
+     * Returns true if the bounding box of each object is padded by how far it
+     * moves per update.
+     */
+    bool isAdaptivePadding() const {
+        return adaptivePadding;
+    }
+
+    /**
+     * Returns the distance by which searches currently inflate the radius they
+     * test nodes with, which is the largest distance an object moved out of
+     * its bounding box.
+     */
+    float getStaleness() const {
+        return staleness;
+    }
+
+#ifndef MSG_HEADLESS
     // Used for testing/visualization purposes. Should be removed before it's added to CUGL
     void draw(const std::shared_ptr<SpriteBatch> &batch);
+#endif
 };
 
 #endif
@@ -0,0 +1,206 @@
+//
+//  RTreeKernel.h
+//
+//  This header implements the circle-box and box-box intersection tests that
+//  R-tree searches run over the children of a node. The bounding boxes of the
+//  children are stored as structure-of-arrays, so that a test can be done
+//  for a whole group of children at once with AVX2 or SSE, producing a bitmask
+//  of the children that intersect the query. Platforms without either fall
+//  back to a scalar loop with the same results.
+//
+//  CUGL MIT License:
+//      This software is provided 'as-is', without any express or implied
+//      warranty.  In no event will the authors be held liable for any damages
+//      arising from the use of this software.
+//
+//      Permission is granted to anyone to use this software for any purpose,
+//      including commercial applications, and to alter it and redistribute it
+//      freely, subject to the following restrictions:
+//
+//      1. The origin of this software must not be misrepresented; you must not
+//      claim that you wrote the original software. If you use this software
+//      in a product, an acknowledgment in the product documentation would be
+//      appreciated but is not required.
+//
+//      2. Altered source versions must be plainly marked as such, and must not
+//      be misrepresented as being the original software.
+//
+//      3. This notice may not be removed or altered from any source distribution.
+//
+//  Author: Simon Kapen
+//  Version: 12/15/2023
+//
+
+#ifndef RTREEKERNEL_H
+#define RTREEKERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RTREE_SSE2
+#endif
+
+/**
+ * The number of boxes tested at once. Child bounds are padded to a multiple
+ * of this with empty boxes, which never intersect a finite circle or box.
+ * They do intersect infinite ones, so callers must AND the mask a kernel
+ * returns with the mask of the children that exist.
+ */
+constexpr size_t RTREE_LANES = 8;
+
+/** The smallest coordinate of an empty box. */
+constexpr float RTREE_EMPTY_MIN = std::numeric_limits<float>::infinity();
+
+/** The largest coordinate of an empty box. */
+constexpr float RTREE_EMPTY_MAX = -std::numeric_limits<float>::infinity();
+
+/**
+ * Returns the number of boxes that the bounds of count children are padded to.
+ *
+ * @param count the number of children
+ */
+inline size_t rtreePaddedCount(size_t count) {
+    return (count + RTREE_LANES - 1) / RTREE_LANES * RTREE_LANES;
+}
+
+/**
+ * Returns the index of the lowest set bit of a mask, which must not be 0.
+ *
+ * @param mask the mask
+ */
+inline int rtreeLowestBit(uint64_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+/**
+ * Tests a group of boxes against a circle. A box intersects the circle if
+ * the point of the box that is closest to the center is within the radius.
+ *
+ * @param minX the smallest x-coordinates of the boxes
+ * @param minY the smallest y-coordinates of the boxes
+ * @param maxX the largest x-coordinates of the boxes
+ * @param maxY the largest y-coordinates of the boxes
+ * @param count the number of boxes, a multiple of RTREE_LANES of at most 64
+ * @param cx the x-coordinate of the center of the circle
+ * @param cy the y-coordinate of the center of the circle
+ * @param radius the radius of the circle
+ * @return a mask with bit i set if box i intersects the circle
+ */
+inline uint64_t circleBoxMask(const float* minX, const float* minY,
+                              const float* maxX, const float* maxY, size_t count,
+                              float cx, float cy, float radius) {
+    uint64_t mask = 0;
+    float r2 = radius * radius;
+#if defined(__AVX2__)
+    const __m256 x = _mm256_set1_ps(cx);
+    const __m256 y = _mm256_set1_ps(cy);
+    const __m256 rr = _mm256_set1_ps(r2);
+    const __m256 zero = _mm256_setzero_ps();
+    for (size_t i = 0; i < count; i += 8) {
+        __m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(minX + i), x),
+                                                _mm256_sub_ps(x, _mm256_loadu_ps(maxX + i))), zero);
+        __m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(minY + i), y),
+                                                _mm256_sub_ps(y, _mm256_loadu_ps(maxY + i))), zero);
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        int hits = _mm256_movemask_ps(_mm256_cmp_ps(d2, rr, _CMP_LE_OQ));
+        mask |= (uint64_t)(unsigned)hits << i;
+    }
+#elif defined(RTREE_SSE2)
+    const __m128 x = _mm_set1_ps(cx);
+    const __m128 y = _mm_set1_ps(cy);
+    const __m128 rr = _mm_set1_ps(r2);
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minX + i), x),
+                                          _mm_sub_ps(x, _mm_loadu_ps(maxX + i))), zero);
+        __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minY + i), y),
+                                          _mm_sub_ps(y, _mm_loadu_ps(maxY + i))), zero);
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        int hits = _mm_movemask_ps(_mm_cmple_ps(d2, rr));
+        mask |= (uint64_t)(unsigned)hits << i;
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        float dx = minX[i] - cx > cx - maxX[i] ? minX[i] - cx : cx - maxX[i];
+        float dy = minY[i] - cy > cy - maxY[i] ? minY[i] - cy : cy - maxY[i];
+        dx = dx > 0 ? dx : 0;
+        dy = dy > 0 ? dy : 0;
+        if (dx * dx + dy * dy <= r2) {
+            mask |= (uint64_t)1 << i;
+        }
+    }
+#endif
+    return mask;
+}
+
+/**
+ * Tests a group of boxes against a query box. Boxes that touch the query box
+ * intersect it.
+ *
+ * @param minX the smallest x-coordinates of the boxes
+ * @param minY the smallest y-coordinates of the boxes
+ * @param maxX the largest x-coordinates of the boxes
+ * @param maxY the largest y-coordinates of the boxes
+ * @param count the number of boxes, a multiple of RTREE_LANES of at most 64
+ * @param qMinX the smallest x-coordinate of the query box
+ * @param qMinY the smallest y-coordinate of the query box
+ * @param qMaxX the largest x-coordinate of the query box
+ * @param qMaxY the largest y-coordinate of the query box
+ * @return a mask with bit i set if box i intersects the query box
+ */
+inline uint64_t boxBoxMask(const float* minX, const float* minY,
+                           const float* maxX, const float* maxY, size_t count,
+                           float qMinX, float qMinY, float qMaxX, float qMaxY) {
+    uint64_t mask = 0;
+#if defined(__AVX2__)
+    const __m256 x0 = _mm256_set1_ps(qMinX);
+    const __m256 y0 = _mm256_set1_ps(qMinY);
+    const __m256 x1 = _mm256_set1_ps(qMaxX);
+    const __m256 y1 = _mm256_set1_ps(qMaxY);
+    for (size_t i = 0; i < count; i += 8) {
+        __m256 inX = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(minX + i), x1, _CMP_LE_OQ),
+                                   _mm256_cmp_ps(_mm256_loadu_ps(maxX + i), x0, _CMP_GE_OQ));
+        __m256 inY = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(minY + i), y1, _CMP_LE_OQ),
+                                   _mm256_cmp_ps(_mm256_loadu_ps(maxY + i), y0, _CMP_GE_OQ));
+        int hits = _mm256_movemask_ps(_mm256_and_ps(inX, inY));
+        mask |= (uint64_t)(unsigned)hits << i;
+    }
+#elif defined(RTREE_SSE2)
+    const __m128 x0 = _mm_set1_ps(qMinX);
+    const __m128 y0 = _mm_set1_ps(qMinY);
+    const __m128 x1 = _mm_set1_ps(qMaxX);
+    const __m128 y1 = _mm_set1_ps(qMaxY);
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 inX = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(minX + i), x1),
+                                _mm_cmpge_ps(_mm_loadu_ps(maxX + i), x0));
+        __m128 inY = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(minY + i), y1),
+                                _mm_cmpge_ps(_mm_loadu_ps(maxY + i), y0));
+        int hits = _mm_movemask_ps(_mm_and_ps(inX, inY));
+        mask |= (uint64_t)(unsigned)hits << i;
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        if (minX[i] <= qMaxX && maxX[i] >= qMinX && minY[i] <= qMaxY && maxY[i] >= qMinY) {
+            mask |= (uint64_t)1 << i;
+        }
+    }
+#endif
+    return mask;
+}
+
+#endif
@@ -1,8 +1,11 @@
 //
 //  RTreeNode.cpp
 //
-//  This class implements a node of an R-tree, which is represented by a bounding
-//  box that encloses all of the bounding boxes of its children.
+//  This class implements the nodes of an R-tree. Every node is represented by a
+//  bounding box that encloses all of the bounding boxes of its children.
+//
+//  The nodes live in an RTreeNodePool, which stores them in contiguous arrays
+//  and addresses them by 32-bit index.
 //
 //  CUGL MIT License:
 //      This software is provided 'as-is', without any express or implied
@@ -28,138 +31,172 @@
 //
 
 #include "rtreenode.h"
-#include <cugl/cugl.h>
-#include <iostream>
-#include <memory>
+#include "CUGLShim.h"
 #include <string>
 #include <vector>
 
 using namespace cugl;
 
-/**
- * Creates an RTreeNode from coordinates and width/height of the bounding box,
- * a list of children, and the level of the node.
- *
- * @param x1 The x-coord of the lower-left corner of the node's bounding box.
- * @param y1 The y-coord of the lower-left corner of the node's bounding box.
- * @param width The x-coord of the upper-right corner of the node's bounding box.
- * @param height The y-coord of the upper-right corner of the node's bounding box.
- * @param children Vector of pointers to the children nodes of this node.
- * @param level The level of this node in the R-tree.
- */
-RTreeNode::RTreeNode(int x1, int y1, int width, int height,
-                     std::vector<std::shared_ptr<RTreeNode>> children,
-                     int level)
-    : level(level), rect(x1, y1, width, height), children(children) {}
+/** The box stored in unused child slots, which never intersects a query. */
+static const RTreeBox EMPTY_BOX(RTREE_EMPTY_MIN, RTREE_EMPTY_MIN, RTREE_EMPTY_MAX, RTREE_EMPTY_MAX);
 
 /**
- * Creates an RTreeNode from a bounding box, a list of children, and the level of the node.
+ * Creates an empty pool of nodes with the given number of child slots.
  *
- * @param r The pointer to the Rect bounding box of the node.
- * @param children The children nodes of this node.
- * @param level The level of this node in the R-tree.
+ * @param capacity The number of child slots of every node.
  */
-RTreeNode::RTreeNode(Rect r, std::vector<std::shared_ptr<RTreeNode>> children,
-                     int level)
-    : level(level), rect(r), children(children) {}
+RTreeNodePool::RTreeNodePool(size_t capacity)
+    : capacity(capacity), stride(rtreePaddedCount(capacity)) {}
 
 /**
- * Creates an RTreeNode from a list of children and a level.
+ * Returns a new node without children. The node reuses a released node or
+ * memory kept by clear() when it can.
  *
- * @param children The children nodes of this node.
- * @param level The level of this node in the R-tree.
+ * @param level The level of the node.
+ * @return The index of the node.
  */
-RTreeNode::RTreeNode(std::vector<std::shared_ptr<RTreeNode>> children,
-                     int level)
-    : level(level), children(children) {
-    if (children.size() > 0) {
-        rect = Rect(children[0]->rect);
-        for (auto it = children.begin(); it != children.end(); ++it) {
-            rect += (*it)->rect;
+RTreeIndex RTreeNodePool::acquire(int level) {
+    RTreeIndex n;
+    if (!freeNodes.empty()) {
+        n = freeNodes.back();
+        freeNodes.pop_back();
+    } else {
+        n = (RTreeIndex)nodes.size();
+        nodes.emplace_back();
+        children.resize(children.size() + capacity, RTREE_NONE);
+        tags.resize(tags.size() + capacity, 0);
+        bounds.resize(bounds.size() + 4 * stride);
+        float* b = boundsOf(n);
+        for (size_t i = 0; i < stride; i++) {
+            storeBox(b, i, EMPTY_BOX);
         }
     }
+    nodes[n].level = level;
+    nodes[n].count = 0;
+    return n;
 }
 
 /**
- * Creates an RTreeNode from a bounding rectangle and a level.
+ * Releases a node, so that it can be reused. Its children are not released.
  *
- * @param children The children nodes of this node.
- * @param level The level of this node in the R-tree.
+ * @param n The node to release.
  */
-RTreeNode::RTreeNode(Rect r, int level) : level(level), rect(r) {}
+void RTreeNodePool::release(RTreeIndex n) {
+    clearChildren(n);
+    freeNodes.push_back(n);
+}
 
 /**
- * Creates an RTreeNode from a bounding rectangle.
- *
- * @param children The children nodes of this node.
- * @param level The level of this node in the R-tree.
+ * Releases every node, keeping the memory for the nodes acquired next.
  */
-RTreeNode::RTreeNode(Rect r) : rect(r) {}
+void RTreeNodePool::clear() {
+    nodes.clear();
+    children.clear();
+    bounds.clear();
+    tags.clear();
+    freeNodes.clear();
+}
 
 /**
- * Removes a child node from this node.
+ * Returns the smallest box that contains the bounding boxes of the
+ * children of a node, which must have at least one child.
  *
- * @param c The address of the child node to be removed.
+ * @param n The node.
  */
-void RTreeNode::deleteChild(const RTreeNode& c) {
-    auto it = std::find_if(
-        children.begin(), children.end(),
-        [&](const std::shared_ptr<RTreeNode>& ptr) { return ptr.get() == &c; });
+RTreeBox RTreeNodePool::getBounds(RTreeIndex n) const {
+    RTreeBox box = getChildBox(n, 0);
+    for (size_t i = 1; i < nodes[n].count; i++) {
+        box += getChildBox(n, i);
+    }
+    return box;
+}
 
-    if (it != children.end()) {
-        children.erase(it);
+/**
+ * Returns the union of the tag masks of the children of a node.
+ *
+ * @param n The node.
+ */
+uint64_t RTreeNodePool::getTags(RTreeIndex n) const {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        mask |= getChildTags(n, i);
     }
+    return mask;
+}
+
+/**
+ * Adds a child to a node, which must have a free slot.
+ *
+ * @param n The node.
+ * @param child The child to add.
+ * @param box The bounding box of the child.
+ * @param mask The tag mask of the child.
+ */
+void RTreeNodePool::addChild(RTreeIndex n, RTreeIndex child, const RTreeBox& box, uint64_t mask) {
+    size_t i = nodes[n].count++;
+    children[capacity * n + i] = child;
+    tags[capacity * n + i] = mask;
+    setChildBox(n, i, box);
 }
 
 /**
- * Recursively delete all children of this RTreeNode.
+ * Removes a child from a node. The children after it move up one slot.
  *
- * This does NOT delete any of the RTreeObjects contained in the leaves of the tree.
+ * @param n The node.
+ * @param i The position of the child.
  */
-void RTreeNode::deleteChildren() {
-    for (auto& child : children) {
-        child->deleteChildren();
+void RTreeNodePool::removeChild(RTreeIndex n, size_t i) {
+    size_t last = --nodes[n].count;
+    RTreeIndex* slots = children.data() + capacity * n;
+    uint64_t* masks = tags.data() + capacity * n;
+    float* b = boundsOf(n);
+    for (size_t j = i; j < last; j++) {
+        slots[j] = slots[j + 1];
+        masks[j] = masks[j + 1];
+        storeBox(b, j, getChildBox(n, j + 1));
     }
-    children.clear();
+    slots[last] = RTREE_NONE;
+    masks[last] = 0;
+    storeBox(b, last, EMPTY_BOX);
 }
 
 /**
- * Adds a child node to this node.
+ * Removes all children from a node.
  *
- * @param c The address of the child node to be added.
+ * @param n The node.
  */
-void RTreeNode::addChild(const std::shared_ptr<RTreeNode>& c) {
-    children.push_back(c);
+void RTreeNodePool::clearChildren(RTreeIndex n) {
+    float* b = boundsOf(n);
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        children[capacity * n + i] = RTREE_NONE;
+        tags[capacity * n + i] = 0;
+        storeBox(b, i, EMPTY_BOX);
+    }
+    nodes[n].count = 0;
 }
 
 /**
- * Return a string representation of this tree.
+ * Returns a string representation of a subtree.
  *
+ * @param n The root of the subtree.
  * @param height The height of the tree.
  * @return std::string
  */
-std::string RTreeNode::print(int height) const {
+std::string RTreeNodePool::print(RTreeIndex n, int height) const {
     std::string res = "";
     std::string indentation = "";
-    for (int i = 0; i < height - level; ++i) {
+    for (int i = 0; i < height - nodes[n].level; ++i) {
         indentation += " ";
     }
-    std::string nodeInfo = indentation + "[(" + std::to_string(rect.getMinX()) +
-                            ", " + std::to_string(rect.getMinY()) + "), (" +
-                            std::to_string(rect.getMaxX()) + ", " +
-                            std::to_string(rect.getMaxY()) + ")]\n";
-    res += nodeInfo;
-    for (const auto& child : children) {
-        res += child->print(height);
+    for (size_t i = 0; i < nodes[n].count; i++) {
+        Rect rect = getChildBox(n, i).toRect();
+        res += indentation + "[(" + std::to_string(rect.getMinX()) +
+               ", " + std::to_string(rect.getMinY()) + "), (" +
+               std::to_string(rect.getMaxX()) + ", " +
+               std::to_string(rect.getMaxY()) + ")]\n";
+        if (nodes[n].level > 0) {
+            res += print(getChild(n, i), height);
+        }
     }
     return res;
 }
-
-void RTreeNode::draw(const std::shared_ptr<SpriteBatch>& batch) {
-    Rect r = Rect((rect.origin.x) / 1024, (rect.origin.y) / 576,
-                (rect.size.width) / 1024, (rect.size.height) / 576);
-    batch->outline(r);
-    for (auto& child : children) {
-        child->draw(batch);
-    }
-}
@@ -1,8 +1,17 @@
 //
 //  RTreeNode.h
 //
-//  This class implements a node of an R-tree, which is represented by a bounding
-//  box that encloses all of the bounding boxes of its children.
+//  This class implements the nodes of an R-tree. Every node is represented by a
+//  bounding box that encloses all of the bounding boxes of its children.
+//
+//  The nodes are not allocated individually. They live in an RTreeNodePool,
+//  which stores them in contiguous arrays and addresses them by 32-bit index.
+//  Every node has a fixed number of child slots, and the bounding boxes of the
+//  children are stored next to each other as structure-of-arrays, so that they
+//  can be tested against a query with circleBoxMask. Every child slot also has
+//  a tag mask, the tags of an object or the union of the tags below a node, so
+//  that tag-filtered queries skip subtrees without the tag. Clearing the pool
+//  keeps its memory, so rebuilding a tree does not allocate.
 //
 //  CUGL MIT License:
 //      This software is provided 'as-is', without any express or implied
@@ -30,103 +39,404 @@
 #ifndef NODE_H
 #define NODE_H
 
-#include <memory>
+#include <cmath>
+#include <cstdint>
 #include <string>
 #include <vector>
-#include "rtreeobject.h"
-#include <cugl/cugl.h>
+#include "rtreekernel.h"
+#include "CUGLShim.h"
 
 using namespace cugl;
 
+/**
+ * The index of a node in an RTreeNodePool. The children of a node at level 0
+ * are the indices of objects instead.
+ */
+typedef uint32_t RTreeIndex;
+
+/** The index that refers to no node. */
+constexpr RTreeIndex RTREE_NONE = UINT32_MAX;
+
+class RTreeBox {
+public:
+    /** The smallest x-coordinate of this box. */
+    float minX;
+    /** The smallest y-coordinate of this box. */
+    float minY;
+    /** The largest x-coordinate of this box. */
+    float maxX;
+    /** The largest y-coordinate of this box. */
+    float maxY;
+
+    /**
+     * Creates an uninitialized box.
+     */
+    RTreeBox() {}
+
+    /**
+     * Creates a box from its corners.
+     *
+     * @param minX The smallest x-coordinate of the box.
+     * @param minY The smallest y-coordinate of the box.
+     * @param maxX The largest x-coordinate of the box.
+     * @param maxY The largest y-coordinate of the box.
+     */
+    RTreeBox(float minX, float minY, float maxX, float maxY)
+        : minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
+
+    /**
+     * Creates a box with the corners of a rectangle.
+     *
+     * @param r The rectangle.
+     */
+    explicit RTreeBox(const Rect& r)
+        : minX(r.getMinX()), minY(r.getMinY()), maxX(r.getMaxX()), maxY(r.getMaxY()) {}
+
+    /** Returns the x-coordinate of the center of this box. */
+    float getMidX() const { return (minX + maxX) / 2.0f; }
+
+    /** Returns the y-coordinate of the center of this box. */
+    float getMidY() const { return (minY + maxY) / 2.0f; }
+
+    /** Returns the area of this box. */
+    float getArea() const { return (maxX - minX) * (maxY - minY); }
+
+    /** Returns the margin of this box, the sum of the lengths of its sides. */
+    float getMargin() const { return 2 * ((maxX - minX) + (maxY - minY)); }
+
+    /**
+     * Returns the area of the intersection of this box and the given box.
+     *
+     * @param b The box to intersect with.
+     */
+    float getOverlap(const RTreeBox& b) const {
+        float w = (maxX < b.maxX ? maxX : b.maxX) - (minX > b.minX ? minX : b.minX);
+        float h = (maxY < b.maxY ? maxY : b.maxY) - (minY > b.minY ? minY : b.minY);
+        return w > 0 && h > 0 ? w * h : 0;
+    }
+
+    /**
+     * Returns true if this box contains the given box.
+     *
+     * @param b The box to check.
+     */
+    bool contains(const RTreeBox& b) const {
+        return minX <= b.minX && b.maxX <= maxX && minY <= b.minY && b.maxY <= maxY;
+    }
+
+    /**
+     * Returns the smallest box that contains both this box and the given box.
+     *
+     * @param b The box to merge with.
+     */
+    RTreeBox getMerge(const RTreeBox& b) const {
+        return RTreeBox(minX < b.minX ? minX : b.minX, minY < b.minY ? minY : b.minY,
+                        maxX > b.maxX ? maxX : b.maxX, maxY > b.maxY ? maxY : b.maxY);
+    }
+
+    /**
+     * Expands this box to contain the given box.
+     *
+     * @param b The box to merge with.
+     */
+    RTreeBox& operator+=(const RTreeBox& b) {
+        return *this = getMerge(b);
+    }
+
+    /**
+     * Returns the distance from a point to the closest point of this box, or
+     * 0 if the box contains the point.
+     *
+     * @param p The point.
+     */
+    float getDistance(const Vec2 p) const {
+        float dx = minX - p.x > p.x - maxX ? minX - p.x : p.x - maxX;
+        float dy = minY - p.y > p.y - maxY ? minY - p.y : p.y - maxY;
+        dx = dx > 0 ? dx : 0;
+        dy = dy > 0 ? dy : 0;
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    /** Returns this box as a rectangle. */
+    Rect toRect() const { return Rect(minX, minY, maxX - minX, maxY - minY); }
+};
+
+/**
+ * A child of a node together with its bounding box, used while building and
+ * splitting nodes.
+ */
+class RTreeEntry {
+public:
+    /** The bounding box of the child. */
+    RTreeBox box;
+    /** The child, a node or an object. */
+    RTreeIndex index;
+};
+
 class RTreeNode {
 public:
-    /** The level of this node in the R-tree. Leaf nodes have a level of -1. */
+    /** The level of this node in the R-tree. The children of level 0 are objects. */
     int level;
-    /** The bounding box of this node. */
-    Rect rect;
-    /** The children of this node, if it is an inner node. */
-    std::vector<std::shared_ptr<RTreeNode>> children;
-    /**  The object contained by this node, if it is a leaf node. */
-    std::shared_ptr<RTreeObject> obj;
+    /** The number of children of this node. */
+    uint32_t count;
+};
+
+class RTreeNodePool {
+private:
+    /** The number of child slots of every node. */
+    size_t capacity;
+
+    /** The number of boxes in each of the bound arrays of a node. */
+    size_t stride;
+
+    /** The nodes, indexed by RTreeIndex. */
+    std::vector<RTreeNode> nodes;
+
+    /** The child slots of the nodes, capacity per node. */
+    std::vector<RTreeIndex> children;
+
+    /**
+     * The bounding boxes of the children, 4 * stride per node: the smallest
+     * x-coordinates, then the smallest y-coordinates, the largest x-coordinates
+     * and the largest y-coordinates. Unused slots hold empty boxes.
+     */
+    std::vector<float> bounds;
 
     /**
-     * Removes a child node from this node.
+     * The tag masks of the children, capacity per node: the tags of an object,
+     * or the union of the tag masks of the children of a node. A mask may have
+     * bits of tags that were since removed.
+     */
+    std::vector<uint64_t> tags;
+
+    /** The released nodes, which are reused before the pool grows. */
+    std::vector<RTreeIndex> freeNodes;
+
+    /**
+     * Returns the bounds of a node.
      *
-     * @param c The address of the child node to be removed.
+     * @param n The node.
      */
-    void deleteChild(const RTreeNode& c);
-    
+    float* boundsOf(RTreeIndex n) { return bounds.data() + 4 * stride * n; }
+
     /**
-     * Recursively deletes all children of this RTreeNode.
+     * Returns the bounds of a node.
      *
-     * This does NOT delete any of the RTreeObjects contained in the leaves of the tree.
+     * @param n The node.
      */
-    void deleteChildren();
+    const float* boundsOf(RTreeIndex n) const { return bounds.data() + 4 * stride * n; }
 
     /**
-     * Adds a child node to this node.
+     * Stores a bounding box in a slot of the bounds of a node.
      *
-     * @param c The address of the child node to be added.
+     * @param b The bounds of the node.
+     * @param i The slot.
+     * @param box The box to store.
      */
-    void addChild(const std::shared_ptr<RTreeNode>& c);
+    void storeBox(float* b, size_t i, const RTreeBox& box) {
+        b[i] = box.minX;
+        b[stride + i] = box.minY;
+        b[2 * stride + i] = box.maxX;
+        b[3 * stride + i] = box.maxY;
+    }
 
+public:
     /**
-     * Returns a string representation of this tree.
+     * Creates an empty pool of nodes with the given number of child slots.
      *
-     * @param height The height of the tree.
-     * @return std::string
+     * @param capacity The number of child slots of every node.
      */
-    std::string print(int height) const;
+    RTreeNodePool(size_t capacity);
 
     /**
-     * Creates a new RTreeNode object from coordinates and width/height of the bounding box,
-     * a list of children, and the level of the node.
+     * Returns the number of child slots of every node.
+     */
+    size_t getCapacity() const { return capacity; }
+
+    /**
+     * Returns the number of nodes in use.
+     */
+    size_t size() const { return nodes.size() - freeNodes.size(); }
+
+    /**
+     * Returns a new node without children. The node reuses a released node or
+     * memory kept by clear() when it can.
+     *
+     * @param level The level of the node.
+     * @return The index of the node.
+     */
+    RTreeIndex acquire(int level);
+
+    /**
+     * Releases a node, so that it can be reused. Its children are not released.
+     *
+     * @param n The node to release.
+     */
+    void release(RTreeIndex n);
+
+    /**
+     * Releases every node, keeping the memory for the nodes acquired next.
+     */
+    void clear();
+
+    /**
+     * Returns a node.
+     *
+     * @param n The index of the node.
+     */
+    RTreeNode& operator[](RTreeIndex n) { return nodes[n]; }
+
+    /**
+     * Returns a node.
+     *
+     * @param n The index of the node.
+     */
+    const RTreeNode& operator[](RTreeIndex n) const { return nodes[n]; }
+
+    /**
+     * Returns a child of a node.
+     *
+     * @param n The node.
+     * @param i The position of the child.
+     */
+    RTreeIndex getChild(RTreeIndex n, size_t i) const { return children[capacity * n + i]; }
+
+    /**
+     * Returns the bounding box of a child of a node.
+     *
+     * @param n The node.
+     * @param i The position of the child.
+     */
+    RTreeBox getChildBox(RTreeIndex n, size_t i) const {
+        const float* b = boundsOf(n);
+        return RTreeBox(b[i], b[stride + i], b[2 * stride + i], b[3 * stride + i]);
+    }
+
+    /**
+     * Changes the bounding box of a child of a node.
      *
-     * @param x1 The x-coord of the lower-left corner of the node's bounding box.
-     * @param y1 The y-coord of the lower-left corner of the node's bounding box.
-     * @param width The x-coord of the upper-right corner of the node's bounding box.
-     * @param height The y-coord of the upper-right corner of the node's bounding box.
-     * @param children Vector of pointers to the children nodes of this node.
-     * @param level The level of this node in the R-tree.
+     * @param n The node.
+     * @param i The position of the child.
+     * @param box The new bounding box.
      */
-    RTreeNode(int x1, int y1, int width, int height,
-              std::vector<std::shared_ptr<RTreeNode>> children, int level);
+    void setChildBox(RTreeIndex n, size_t i, const RTreeBox& box) {
+        storeBox(boundsOf(n), i, box);
+    }
 
     /**
-     * Creates an RTreeNode from a bounding box, a list of children, and the level of the node.
+     * Returns the tag mask of a child of a node.
      *
-     * @param r The pointer to the Rect bounding box of the node.
-     * @param children The children nodes of this node.
-     * @param level The level of this node in the R-tree.
+     * @param n The node.
+     * @param i The position of the child.
      */
-    RTreeNode(Rect r, std::vector<std::shared_ptr<RTreeNode>> children, int level);
-    
+    uint64_t getChildTags(RTreeIndex n, size_t i) const { return tags[capacity * n + i]; }
+
+    /**
+     * Changes the tag mask of a child of a node.
+     *
+     * @param n The node.
+     * @param i The position of the child.
+     * @param mask The new tag mask.
+     */
+    void setChildTags(RTreeIndex n, size_t i, uint64_t mask) { tags[capacity * n + i] = mask; }
+
+    /**
+     * Returns the union of the tag masks of the children of a node.
+     *
+     * @param n The node.
+     */
+    uint64_t getTags(RTreeIndex n) const;
+
+    /**
+     * Returns the smallest box that contains the bounding boxes of the
+     * children of a node, which must have at least one child.
+     *
+     * @param n The node.
+     */
+    RTreeBox getBounds(RTreeIndex n) const;
+
     /**
-     * Creates an RTreeNode from a list of children and a level.
+     * Adds a child to a node, which must have a free slot.
      *
-     * @param children The children nodes of this node.
-     * @param level The level of this node in the R-tree.
+     * @param n The node.
+     * @param child The child to add.
+     * @param box The bounding box of the child.
+     * @param mask The tag mask of the child.
      */
-    RTreeNode(std::vector<std::shared_ptr<RTreeNode>> children, int level);
-    
+    void addChild(RTreeIndex n, RTreeIndex child, const RTreeBox& box, uint64_t mask);
+
     /**
-     * Creates an RTreeNode from a bounding rectangle and a level.
+     * Removes a child from a node. The children after it move up one slot.
      *
-     * @param children The children nodes of this node.
-     * @param level The level of this node in the R-tree.
+     * @param n The node.
+     * @param i The position of the child.
      */
-    RTreeNode(Rect r, int level);
+    void removeChild(RTreeIndex n, size_t i);
 
     /**
-     * Creates an RTreeNode from a bounding rectangle.
+     * Removes all children from a node.
      *
-     * @param children The children nodes of this node.
-     * @param level The level of this node in the R-tree.
+     * @param n The node.
      */
-    RTreeNode(Rect r);
+    void clearChildren(RTreeIndex n);
 
-    // Used for testing/visualization purposes. Should be removed before it's added to CUGL
-    void draw(const std::shared_ptr<SpriteBatch>& batch);
+    /**
+     * Returns a mask of the children of a node whose bounding boxes intersect
+     * the given circle, starting at the given child.
+     *
+     * @param n The node.
+     * @param first The first child to test, a multiple of 64.
+     * @param center The center of the circle.
+     * @param radius The radius of the circle.
+     * @return A mask with bit i set if child first + i intersects the circle.
+     */
+    uint64_t intersectChildren(RTreeIndex n, size_t first, const Vec2 center, float radius) const {
+        size_t count = rtreePaddedCount(nodes[n].count) - first;
+        const float* b = boundsOf(n) + first;
+        return circleBoxMask(b, b + stride, b + 2 * stride, b + 3 * stride,
+                             count < 64 ? count : 64, center.x, center.y, radius)
+               & childMask(n, first);
+    }
+
+    /**
+     * Returns a mask of the children of a node whose bounding boxes intersect
+     * the given box, starting at the given child.
+     *
+     * @param n The node.
+     * @param first The first child to test, a multiple of 64.
+     * @param box The box to test against.
+     * @return A mask with bit i set if child first + i intersects the box.
+     */
+    uint64_t overlapChildren(RTreeIndex n, size_t first, const RTreeBox& box) const {
+        size_t count = rtreePaddedCount(nodes[n].count) - first;
+        const float* b = boundsOf(n) + first;
+        return boxBoxMask(b, b + stride, b + 2 * stride, b + 3 * stride,
+                          count < 64 ? count : 64, box.minX, box.minY, box.maxX, box.maxY)
+               & childMask(n, first);
+    }
+
+    /**
+     * Returns a mask of the children of a node that exist, starting at the
+     * given child. The kernels also test the padding after the last child,
+     * whose empty boxes intersect infinite circles and boxes.
+     *
+     * @param n The node.
+     * @param first The first child, a multiple of 64.
+     * @return A mask with bit i set if child first + i exists.
+     */
+    uint64_t childMask(RTreeIndex n, size_t first) const {
+        size_t count = nodes[n].count - first;
+        return count >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << count) - 1;
+    }
+
+    /**
+     * Returns a string representation of a subtree.
+     *
+     * @param n The root of the subtree.
+     * @param height The height of the tree.
+     * @return std::string
+     */
+    std::string print(RTreeIndex n, int height) const;
 };
 
 #endif
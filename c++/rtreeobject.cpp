@@ -29,12 +29,50 @@
 //
 
 #include "rtreeobject.h"
-#include <cugl/cugl.h>
+#include "rtree.h"
+#include "CUGLShim.h"
 
 using namespace cugl;
 
 RTreeObject::RTreeObject(float x, float y, float width, float height) {
     rect = Rect(x, y, width, height);
+    tagMask = 0;
+    hasVelocity = false;
+}
+
+/**
+ * Creates a copy of an RTreeObject. The copy has the bounding box, tags
+ * and velocity of the original, but is not in any RTree.
+ *
+ * @param other The object to copy.
+ */
+RTreeObject::RTreeObject(const RTreeObject& other)
+    : tags(other.tags), tagMask(other.tagMask), velocity(other.velocity),
+      hasVelocity(other.hasVelocity), rect(other.rect) {}
+
+/**
+ * Copies the bounding box, tags and velocity of another RTreeObject. This
+ * object stays in the RTrees it is in, and not in those of the other.
+ *
+ * @param other The object to copy.
+ * @return This object.
+ */
+RTreeObject& RTreeObject::operator=(const RTreeObject& other) {
+    if (this == &other) {
+        return *this;
+    }
+    uint64_t added = other.tagMask & ~tagMask;
+    tags = other.tags;
+    tagMask = other.tagMask;
+    velocity = other.velocity;
+    hasVelocity = other.hasVelocity;
+    rect = other.rect;
+    if (added != 0) {
+        for (const std::pair<RTree*, uint32_t>& slot : slots) {
+            slot.first->addObjectTag(slot.second, added);
+        }
+    }
+    return *this;
 }
 
 /**
@@ -44,6 +82,14 @@ RTreeObject::RTreeObject(float x, float y, float width, float height) {
  */
 void RTreeObject::addTag(int tag){
     tags.insert(tag);
+    uint64_t bit = rtreeTagBit(tag);
+    if ((tagMask & bit) == 0) {
+        tagMask |= bit;
+        // the nodes above this object do not have the bit yet
+        for (const std::pair<RTree*, uint32_t>& slot : slots) {
+            slot.first->addObjectTag(slot.second, bit);
+        }
+    }
 }
 
 /**
@@ -53,6 +99,12 @@ void RTreeObject::addTag(int tag){
  */
 void RTreeObject::removeTag(int tag){
     tags.erase(tag);
+
+    // other tags may share the bit
+    tagMask = 0;
+    for (int t : tags) {
+        tagMask |= rtreeTagBit(t);
+    }
 }
 
 /**
@@ -62,7 +114,13 @@ void RTreeObject::removeTag(int tag){
  * @return true if this object subscribes to the given tag, and false otherwise.
  */
 bool RTreeObject::containsTag(int tag){
-    return tag == -1 || tags.find(tag) != tags.end();
+    if (tag == -1) {
+        return true;
+    }
+    if ((tagMask & rtreeTagBit(tag)) == 0) {
+        return false;
+    }
+    return rtreeTagIsExact(tag) || tags.find(tag) != tags.end();
 }
 
 /**
@@ -31,19 +31,72 @@
 #ifndef OBJ_H
 #define OBJ_H
 
+#include <cstdint>
 #include <memory>
 #include <random>
 #include <string>
 #include <vector>
 #include <unordered_set>
-#include <cugl/cugl.h>
+#include <utility>
+#include "CUGLShim.h"
 
 using namespace cugl;
 
+/**
+ * The number of tags that have a bit of their own in a tag mask. Larger and
+ * negative tags share the remaining bits.
+ */
+constexpr int RTREE_EXACT_TAGS = 48;
+
+/**
+ * Returns true if a tag has a bit of its own in a tag mask, so that the bit
+ * being set means that the tag is present.
+ *
+ * @param tag The tag.
+ */
+inline bool rtreeTagIsExact(int tag) {
+    return tag >= 0 && tag < RTREE_EXACT_TAGS;
+}
+
+/**
+ * Returns the bit of a tag in a tag mask. A tag mask summarizes a set of
+ * tags like a Bloom filter: if the bit of a tag is not set, the tag is not
+ * in the set.
+ *
+ * @param tag The tag.
+ */
+inline uint64_t rtreeTagBit(int tag) {
+    if (rtreeTagIsExact(tag)) {
+        return (uint64_t)1 << tag;
+    }
+    uint32_t hash = (uint32_t)tag * 2654435761u;
+    return (uint64_t)1 << (RTREE_EXACT_TAGS + (hash >> 28));
+}
+
+class RTree;
+
 class RTreeObject {
 private:
     /** The tags that this object subscribes to. */
     std::unordered_set<int> tags;
+
+    /** The bits of the tags that this object subscribes to. */
+    uint64_t tagMask;
+
+    /**
+     * The RTrees that contain this object, with the slot of this object in
+     * the bounds table of each. An object is usually in one tree, so finding
+     * the slot does not need a hash lookup.
+     */
+    std::vector<std::pair<RTree*, uint32_t>> slots;
+
+    /** The distance this object is expected to move per update, if hasVelocity. */
+    Vec2 velocity;
+
+    /** Whether the expected distance this object moves per update was set. */
+    bool hasVelocity;
+
+    friend class RTree;
 public:
     /** The bounding box of this object. */
     Rect rect;
@@ -57,6 +110,23 @@ public:
     * @param height The y-coordinate of the upper-right corner.
     */
     RTreeObject(float x, float y, float width, float height);
+
+    /**
+     * Creates a copy of an RTreeObject. The copy has the bounding box, tags
+     * and velocity of the original, but is not in any RTree.
+     *
+     * @param other The object to copy.
+     */
+    RTreeObject(const RTreeObject& other);
+
+    /**
+     * Copies the bounding box, tags and velocity of another RTreeObject. This
+     * object stays in the RTrees it is in, and not in those of the other.
+     *
+     * @param other The object to copy.
+     * @return This object.
+     */
+    RTreeObject& operator=(const RTreeObject& other);
     
     /**
      * Adds a tag to the set of subscribed tags.
@@ -86,6 +156,44 @@ public:
      * @return true if this object is subscribed to at least one tag, and false otherwise.
      */
     bool subscribesToTag();
+
+    /**
+     * Returns the bits of the tags that this object subscribes to.
+     */
+    uint64_t getTagMask() const {
+        return tagMask;
+    }
+
+    /**
+     * Sets the distance this object is expected to move per update. RTrees
+     * with adaptive padding then pad its bounding box for this velocity
+     * instead of the one they observe, e.g. for projectiles that are fast from
+     * the moment they are added.
+     *
+     * @param x The expected displacement along the x-axis per update.
+     * @param y The expected displacement along the y-axis per update.
+     */
+    void setVelocity(float x, float y) {
+        velocity = Vec2(x, y);
+        hasVelocity = true;
+    }
+
+    /**
+     * Removes the velocity set by setVelocity, so that RTrees with adaptive
+     * padding pad the bounding box of this object for the velocity they observe.
+     */
+    void clearVelocity() {
+        hasVelocity = false;
+    }
+
+    /**
+     * Returns the distance this object is expected to move per update, or
+     * nullptr if it was not set.
+     */
+    const Vec2* getVelocity() const {
+        return hasVelocity ? &velocity : nullptr;
+    }
+
     
     /**
      * Deconstruct this RTreeObject.